@@ -0,0 +1,575 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && !defined(AIO_NO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define AIO_URING 1
+#endif
+
+#include "aio.h"
+#include "mem.h"
+#include "string.h"
+
+// Double-buffered I/O on the file descriptor underneath a stream: the reader fills the next
+// block while the caller works on the current one, and the writer drains one buffer while the
+// caller fills the other. Each side has a channel with a single transfer in flight, run by
+// io_uring where the kernel offers it (through raw system calls, so no library is needed) and
+// otherwise by a helper thread doing plain read() and write() calls. Building with
+// -DAIO_NO_URING forces the thread. The stream itself must not have buffered anything.
+// Whole blocks can also be handed to the writer, which then writes them from their own memory
+// instead of copying them into its buffer.
+
+// A transfer of `length` bytes; a read also ends early at end of file.
+typedef struct {
+    int fd;
+    bool write;
+    uint8_t *data;
+    size_t length;
+    size_t done;
+    bool eof;
+    bool failed;
+    bool busy;
+} AioOp;
+
+typedef struct {
+    AioOp *op;
+    // io_uring, when ring_fd >= 0.
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    void *sqes;
+    size_t sqes_size;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    void *cqes;
+    // Helper thread otherwise.
+    bool threaded;
+    bool stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AioChannel;
+
+// Runs the rest of a transfer with blocking calls.
+void aio_op_run(AioOp *op) {
+    while (op->done < op->length) {
+        ssize_t result = op->write ? write(op->fd, op->data + op->done, op->length - op->done)
+                                   : read(op->fd, op->data + op->done, op->length - op->done);
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result < 0 || (result == 0 && op->write)) {
+            op->failed = true;
+            return;
+        }
+        if (result == 0) {
+            op->eof = true;
+            return;
+        }
+        op->done += result;
+    }
+}
+
+void *aio_thread_main(void *channel_) {
+    AioChannel *channel = channel_;
+    pthread_mutex_lock(&channel->lock);
+    while (true) {
+        while (!channel->stop && !(channel->op && channel->op->busy)) {
+            pthread_cond_wait(&channel->cond, &channel->lock);
+        }
+        if (channel->stop) {
+            break;
+        }
+        AioOp *op = channel->op;
+        pthread_mutex_unlock(&channel->lock);
+        aio_op_run(op);
+        pthread_mutex_lock(&channel->lock);
+        op->busy = false;
+        pthread_cond_broadcast(&channel->cond);
+    }
+    pthread_mutex_unlock(&channel->lock);
+    return NULL;
+}
+
+#ifdef AIO_URING
+int aio_uring_enter(int ring_fd, unsigned submit, unsigned wait) {
+    while (true) {
+        long result = syscall(__NR_io_uring_enter, ring_fd, submit, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (result >= 0 || errno != EINTR) {
+            return result < 0 ? -1 : 0;
+        }
+    }
+}
+
+// Maps a ring with room for the reader's or writer's single transfer. Reads and writes go to
+// the current file position (offset -1), which is what makes pipes work; kernels without that
+// feature fall back to the thread.
+int aio_uring_init(AioChannel *channel) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    long ring_fd = syscall(__NR_io_uring_setup, 2, &params);
+    if (ring_fd < 0) {
+        return -1;
+    }
+    channel->ring_fd = ring_fd;
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        return -1;
+    }
+    channel->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    channel->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    channel->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    channel->sq_ring = mmap(NULL, channel->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+        IORING_OFF_SQ_RING);
+    channel->cq_ring = mmap(NULL, channel->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+        IORING_OFF_CQ_RING);
+    channel->sqes = mmap(NULL, channel->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+        IORING_OFF_SQES);
+    if (channel->sq_ring == MAP_FAILED || channel->cq_ring == MAP_FAILED || channel->sqes == MAP_FAILED) {
+        return -1;
+    }
+    char *sq = channel->sq_ring;
+    char *cq = channel->cq_ring;
+    channel->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+    channel->sq_mask = (uint32_t *)(sq + params.sq_off.ring_mask);
+    channel->sq_array = (uint32_t *)(sq + params.sq_off.array);
+    channel->cq_head = (uint32_t *)(cq + params.cq_off.head);
+    channel->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+    channel->cq_mask = (uint32_t *)(cq + params.cq_off.ring_mask);
+    channel->cqes = cq + params.cq_off.cqes;
+    return 0;
+}
+
+void aio_uring_close(AioChannel *channel) {
+    if (channel->sqes && channel->sqes != MAP_FAILED) {
+        munmap(channel->sqes, channel->sqes_size);
+    }
+    if (channel->cq_ring && channel->cq_ring != MAP_FAILED) {
+        munmap(channel->cq_ring, channel->cq_ring_size);
+    }
+    if (channel->sq_ring && channel->sq_ring != MAP_FAILED) {
+        munmap(channel->sq_ring, channel->sq_ring_size);
+    }
+    if (channel->ring_fd >= 0) {
+        close(channel->ring_fd);
+    }
+    channel->ring_fd = -1;
+}
+
+// Queues the remainder of the channel's transfer. A single request moves at most 1 GiB.
+int aio_uring_submit(AioChannel *channel) {
+    AioOp *op = channel->op;
+    uint32_t tail = *channel->sq_tail;
+    uint32_t index = tail & *channel->sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)channel->sqes + index;
+    size_t length = op->length - op->done;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = op->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(op->data + op->done);
+    sqe->len = length < (1u << 30) ? length : (1u << 30);
+    sqe->off = (uint64_t)-1;
+    channel->sq_array[index] = index;
+    __atomic_store_n(channel->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return aio_uring_enter(channel->ring_fd, 1, 0);
+}
+
+// Reaps completions until the transfer is done, resubmitting after short reads and writes.
+int aio_uring_wait(AioChannel *channel) {
+    AioOp *op = channel->op;
+    while (op->busy) {
+        uint32_t head = *channel->cq_head;
+        if (head == __atomic_load_n(channel->cq_tail, __ATOMIC_ACQUIRE)) {
+            if (aio_uring_enter(channel->ring_fd, 0, 1) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        const struct io_uring_cqe *cqe = (const struct io_uring_cqe *)channel->cqes + (head & *channel->cq_mask);
+        int result = cqe->res;
+        __atomic_store_n(channel->cq_head, head + 1, __ATOMIC_RELEASE);
+        if (result == -EINTR || result == -EAGAIN) {
+            result = 0;
+        } else if (result < 0 || (result == 0 && op->write)) {
+            op->failed = true;
+            op->busy = false;
+            break;
+        } else if (result == 0) {
+            op->eof = true;
+            op->busy = false;
+            break;
+        }
+        op->done += result;
+        if (op->done == op->length) {
+            op->busy = false;
+        } else if (aio_uring_submit(channel) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+int aio_channel_init(AioChannel *channel) {
+    memset(channel, 0, sizeof(AioChannel));
+    channel->ring_fd = -1;
+#ifdef AIO_URING
+    if (aio_uring_init(channel) == 0) {
+        return 0;
+    }
+    aio_uring_close(channel);
+#endif
+    if (pthread_mutex_init(&channel->lock, NULL) != 0) {
+        return -1;
+    }
+    if (pthread_cond_init(&channel->cond, NULL) != 0) {
+        pthread_mutex_destroy(&channel->lock);
+        return -1;
+    }
+    if (pthread_create(&channel->thread, NULL, aio_thread_main, channel) != 0) {
+        pthread_cond_destroy(&channel->cond);
+        pthread_mutex_destroy(&channel->lock);
+        return -1;
+    }
+    channel->threaded = true;
+    return 0;
+}
+
+// Marks `op` in flight with nothing transferred yet.
+void aio_op_reset(AioOp *op) {
+    op->done = 0;
+    op->eof = false;
+    op->failed = false;
+    op->busy = true;
+}
+
+int aio_channel_submit(AioChannel *channel, AioOp *op) {
+    if (channel->threaded) {
+        // The thread reads these under the lock, so they are reset under it too.
+        pthread_mutex_lock(&channel->lock);
+        aio_op_reset(op);
+        channel->op = op;
+        pthread_cond_broadcast(&channel->cond);
+        pthread_mutex_unlock(&channel->lock);
+        return 0;
+    }
+    aio_op_reset(op);
+    channel->op = op;
+#ifdef AIO_URING
+    if (op->length == 0) {
+        op->busy = false;
+        return 0;
+    }
+    return aio_uring_submit(channel);
+#else
+    return -1;
+#endif
+}
+
+// Waits for the transfer in flight, if any. Returns -1 when it failed.
+int aio_channel_wait(AioChannel *channel) {
+    AioOp *op = channel->op;
+    if (!op) {
+        return 0;
+    }
+    if (channel->threaded) {
+        pthread_mutex_lock(&channel->lock);
+        while (op->busy) {
+            pthread_cond_wait(&channel->cond, &channel->lock);
+        }
+        pthread_mutex_unlock(&channel->lock);
+    } else {
+#ifdef AIO_URING
+        if (aio_uring_wait(channel) < 0) {
+            return -1;
+        }
+#endif
+    }
+    return op->failed ? -1 : 0;
+}
+
+void aio_channel_close(AioChannel *channel) {
+    // A transfer still in flight refers to buffers about to be freed.
+    aio_channel_wait(channel);
+    if (channel->threaded) {
+        pthread_mutex_lock(&channel->lock);
+        channel->stop = true;
+        pthread_cond_broadcast(&channel->cond);
+        pthread_mutex_unlock(&channel->lock);
+        pthread_join(channel->thread, NULL);
+        pthread_cond_destroy(&channel->cond);
+        pthread_mutex_destroy(&channel->lock);
+        channel->threaded = false;
+    }
+#ifdef AIO_URING
+    aio_uring_close(channel);
+#endif
+}
+
+typedef struct {
+    AioChannel channel;
+    AioOp ops[2];
+    // Mapped with mem_map(), which backs blocks of several megabytes with huge pages.
+    String buffers[2];
+    size_t current;
+    bool open;
+} AioReader;
+
+// Returns blocks of `block_size` bytes (the last one shorter, then an empty one at the end).
+// A returned block stays valid until the next call. A reader can be moved on to other streams
+// with aio_reader_detach() and aio_reader_attach(), keeping its buffers and channel.
+void *aio_reader_new(FILE *stream, size_t block_size) {
+    AioReader *reader = mem_alloc(sizeof(AioReader));
+    if (!reader) {
+        return NULL;
+    }
+    memset(reader, 0, sizeof(AioReader));
+    for (size_t i = 0; i < 2; ++i) {
+        reader->buffers[i].data = mem_map(block_size + 1);
+        if (!reader->buffers[i].data) {
+            aio_reader_free(reader);
+            return NULL;
+        }
+        reader->buffers[i].capacity = block_size + 1;
+    }
+    if (aio_channel_init(&reader->channel) < 0) {
+        aio_reader_free(reader);
+        return NULL;
+    }
+    reader->open = true;
+    if (aio_reader_attach(reader, stream) < 0) {
+        aio_reader_free(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+// Starts reading `stream` from its current position. Any earlier stream must have been
+// detached.
+int aio_reader_attach(void *reader_, FILE *stream) {
+    AioReader *reader = reader_;
+    for (size_t i = 0; i < 2; ++i) {
+        String *buffer = &reader->buffers[i];
+        reader->ops[i] = (AioOp){.fd = fileno(stream), .data = buffer->data, .length = buffer->capacity - 1};
+    }
+    reader->current = 0;
+    return aio_channel_submit(&reader->channel, &reader->ops[0]);
+}
+
+// Waits for the read in flight, after which the stream may be closed.
+void aio_reader_detach(void *reader_) {
+    AioReader *reader = reader_;
+    aio_channel_wait(&reader->channel);
+}
+
+const String *aio_reader_next(void *reader_) {
+    AioReader *reader = reader_;
+    if (aio_channel_wait(&reader->channel) < 0) {
+        return NULL;
+    }
+    AioOp *op = &reader->ops[reader->current];
+    String *block = &reader->buffers[reader->current];
+    block->length = op->done;
+    block->data[block->length] = '\0';
+    reader->current ^= 1;
+    AioOp *next = &reader->ops[reader->current];
+    if (op->eof) {
+        // Nothing more to read: the next call sees an empty block.
+        next->length = 0;
+    }
+    if (aio_channel_submit(&reader->channel, next) < 0) {
+        return NULL;
+    }
+    return block;
+}
+
+void aio_reader_free(void *reader_) {
+    AioReader *reader = reader_;
+    if (reader->open) {
+        aio_channel_close(&reader->channel);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        mem_unmap(reader->buffers[i].data, reader->buffers[i].capacity);
+    }
+    mem_free(reader);
+}
+
+typedef struct {
+    AioChannel channel;
+    AioOp op;
+    String *buffers[2];
+    size_t buffer_size;
+    size_t current;
+    // The block handed over by aio_writer_give() that `op` writes or last wrote, if any.
+    String *given;
+    int fd;
+    bool open;
+} AioWriter;
+
+// Collects small writes in one buffer and hands it to the channel once it holds
+// `buffer_size` bytes (at most AIO_WRITE_SIZE), then continues in the other. The buffers grow
+// as writes arrive, so a writer that is mostly given whole blocks stays small. Like a reader,
+// a writer can be moved on to other streams, keeping its channel.
+void *aio_writer_new(FILE *stream, size_t buffer_size) {
+    AioWriter *writer = mem_alloc(sizeof(AioWriter));
+    if (!writer) {
+        return NULL;
+    }
+    memset(writer, 0, sizeof(AioWriter));
+    if (aio_channel_init(&writer->channel) < 0) {
+        aio_writer_free(writer);
+        return NULL;
+    }
+    writer->open = true;
+    if (aio_writer_attach(writer, stream, buffer_size) < 0) {
+        aio_writer_free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+// Waits for the transfer in flight and frees the block it wrote, if it was given.
+int aio_writer_wait(AioWriter *writer) {
+    int result = aio_channel_wait(&writer->channel);
+    if (writer->given) {
+        string_free(writer->given);
+        writer->given = NULL;
+    }
+    return result;
+}
+
+// Starts writing to `stream`. Any earlier stream must have been detached. Buffers grown past
+// `buffer_size` for the previous stream are dropped.
+int aio_writer_attach(void *writer_, FILE *stream, size_t buffer_size) {
+    AioWriter *writer = writer_;
+    if (fflush(stream) != 0) {
+        return -1;
+    }
+    writer->fd = fileno(stream);
+    writer->buffer_size = buffer_size < AIO_WRITE_SIZE ? buffer_size : AIO_WRITE_SIZE;
+    writer->current = 0;
+    for (size_t i = 0; i < 2; ++i) {
+        if (writer->buffers[i] && writer->buffers[i]->capacity > writer->buffer_size + 1) {
+            string_free(writer->buffers[i]);
+            writer->buffers[i] = NULL;
+        }
+        if (!writer->buffers[i]) {
+            writer->buffers[i] = string_new();
+            if (!writer->buffers[i]) {
+                return -1;
+            }
+        }
+        writer->buffers[i]->length = 0;
+    }
+    return 0;
+}
+
+// Waits for the transfer in flight, after which the stream may be closed. Anything still
+// buffered is dropped, so a stream that is to be complete needs aio_writer_finish() first.
+void aio_writer_detach(void *writer_) {
+    AioWriter *writer = writer_;
+    aio_writer_wait(writer);
+    if (writer->buffers[writer->current]) {
+        writer->buffers[writer->current]->length = 0;
+    }
+}
+
+int aio_writer_flush(AioWriter *writer) {
+    if (aio_writer_wait(writer) < 0) {
+        return -1;
+    }
+    String *buffer = writer->buffers[writer->current];
+    writer->op = (AioOp){.fd = writer->fd, .write = true, .data = buffer->data, .length = buffer->length};
+    if (aio_channel_submit(&writer->channel, &writer->op) < 0) {
+        return -1;
+    }
+    writer->current ^= 1;
+    writer->buffers[writer->current]->length = 0;
+    return 0;
+}
+
+int aio_writer_write(void *writer_, const void *data, size_t length) {
+    AioWriter *writer = writer_;
+    String *buffer = writer->buffers[writer->current];
+    // Flushing first keeps each buffer at `buffer_size`, or at one oversized write, so that
+    // the writer's footprint is known in advance.
+    if (buffer->length > 0 && buffer->length + length > writer->buffer_size) {
+        if (aio_writer_flush(writer) < 0) {
+            return -1;
+        }
+        buffer = writer->buffers[writer->current];
+    }
+    size_t needed = buffer->length + length + 1;
+    if (needed > buffer->capacity) {
+        size_t capacity = buffer->capacity * 2 < writer->buffer_size + 1 ? buffer->capacity * 2 : writer->buffer_size + 1;
+        if (string_reserve(buffer, capacity > needed ? capacity : needed) < 0) {
+            return -1;
+        }
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    if (buffer->length >= writer->buffer_size) {
+        return aio_writer_flush(writer);
+    }
+    return 0;
+}
+
+// Writes `block` straight from its memory, after whatever is buffered. The writer owns it
+// from here on, even on error, and frees it once it is written.
+int aio_writer_give(void *writer_, String *block) {
+    AioWriter *writer = writer_;
+    if (writer->buffers[writer->current]->length > 0 && aio_writer_flush(writer) < 0) {
+        string_free(block);
+        return -1;
+    }
+    if (aio_writer_wait(writer) < 0) {
+        string_free(block);
+        return -1;
+    }
+    writer->given = block;
+    writer->op = (AioOp){.fd = writer->fd, .write = true, .data = block->data, .length = block->length};
+    return aio_channel_submit(&writer->channel, &writer->op);
+}
+
+// Writes out everything still buffered and waits for it.
+int aio_writer_finish(void *writer_) {
+    AioWriter *writer = writer_;
+    if (writer->buffers[writer->current]->length > 0 && aio_writer_flush(writer) < 0) {
+        return -1;
+    }
+    return aio_writer_wait(writer);
+}
+
+void aio_writer_free(void *writer_) {
+    AioWriter *writer = writer_;
+    if (writer->open) {
+        aio_channel_close(&writer->channel);
+    }
+    if (writer->given) {
+        string_free(writer->given);
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        if (writer->buffers[i]) {
+            string_free(writer->buffers[i]);
+        }
+    }
+    mem_free(writer);
+}
@@ -0,0 +1,38 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef AIO_H
+#define AIO_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "string.h"
+
+#define AIO_WRITE_SIZE (1 << 20)
+
+void *aio_reader_new(FILE *stream, size_t block_size);
+
+int aio_reader_attach(void *reader, FILE *stream);
+
+void aio_reader_detach(void *reader);
+
+const String *aio_reader_next(void *reader);
+
+void aio_reader_free(void *reader);
+
+void *aio_writer_new(FILE *stream, size_t buffer_size);
+
+int aio_writer_attach(void *writer, FILE *stream, size_t buffer_size);
+
+void aio_writer_detach(void *writer);
+
+int aio_writer_write(void *writer, const void *data, size_t length);
+
+int aio_writer_give(void *writer, String *block);
+
+int aio_writer_finish(void *writer);
+
+void aio_writer_free(void *writer);
+
+#endif // AIO_H
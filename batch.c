@@ -0,0 +1,410 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "aio.h"
+#include "batch.h"
+#include "dict.h"
+#include "frame.h"
+#include "lz.h"
+#include "mem.h"
+#include "stats.h"
+#include "string.h"
+#include "verify.h"
+
+// Files are handed out one at a time from a shared cursor, so a few large files do not hold
+// up a worker's queue of small ones. Every worker keeps its codec contexts (one per algorithm
+// it meets, with and without the dictionary, which is applied once) for all the files it
+// processes, and so its reader and writer, moved from one file's streams to the next. A
+// failure is reported for its file only; the batch goes on and fails at the end.
+
+typedef struct {
+    const BatchOptions *options;
+    const char *const *paths;
+    size_t count;
+    size_t next;
+    size_t failures;
+    // With --max-memory, what each worker may use; 0 otherwise.
+    size_t memory_share;
+    pthread_mutex_t lock;
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    pthread_t thread;
+    LZ_Context *contexts[2][ALGO_CODEC_COUNT + 1];
+    // With --verify, created on the first file and shared by the compressing context.
+    void *verifier;
+    // Created on the first file that needs them, then attached to every file in turn.
+    void *reader;
+    void *writer;
+    Stats stats;
+} BatchWorker;
+
+// A copy of the `length` bytes at `s` as a C string, allocated with mem_alloc().
+char *batch_strndup(const char *s, size_t length) {
+    char *copy = mem_alloc(length + 1);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, s, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+// Reads one path per line; empty lines are skipped. The line buffer belongs to getline() and
+// is freed with free(); the list is counted against --max-memory.
+char **batch_read_list(FILE *stream, size_t *count) {
+    bool error = false;
+    char **paths = NULL;
+    size_t capacity = 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    *count = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_capacity, stream)) >= 0) {
+        if (length > 0 && line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            char **grown = mem_realloc(paths, sizeof(char *) * capacity);
+            if (!grown) {
+                error = true;
+                goto cleanup;
+            }
+            paths = grown;
+        }
+        paths[*count] = batch_strndup(line, length);
+        if (!paths[*count]) {
+            error = true;
+            goto cleanup;
+        }
+        *count += 1;
+    }
+    if (ferror(stream)) {
+        error = true;
+        goto cleanup;
+    }
+
+cleanup:
+    free(line);
+    if (error) {
+        batch_free_list(paths, *count);
+        return NULL;
+    }
+    // An empty list is not an error.
+    if (!paths) {
+        paths = mem_alloc(sizeof(char *));
+    }
+    return paths;
+}
+
+void batch_free_list(char **paths, size_t count) {
+    if (!paths) {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        mem_free(paths[i]);
+    }
+    mem_free(paths);
+}
+
+// The output name: `path` plus BATCH_SUFFIX, or without it when decompressing.
+char *batch_output_path(const char *path, bool decompress) {
+    size_t length = strlen(path);
+    size_t suffix_length = strlen(BATCH_SUFFIX);
+    if (decompress) {
+        if (length <= suffix_length || strcmp(path + length - suffix_length, BATCH_SUFFIX) != 0) {
+            return NULL;
+        }
+        return batch_strndup(path, length - suffix_length);
+    }
+    char *output = mem_alloc(length + suffix_length + 1);
+    if (!output) {
+        return NULL;
+    }
+    memcpy(output, path, length);
+    memcpy(output + length, BATCH_SUFFIX, suffix_length + 1);
+    return output;
+}
+
+// The worker's context for `algo`, with or without the dictionary, created on first use.
+LZ_Context *batch_context(BatchWorker *worker, Algo algo, bool dict) {
+    size_t slot = algo < ALGO_CODEC_COUNT ? (size_t)algo : ALGO_CODEC_COUNT;
+    LZ_Context *ctx = worker->contexts[dict][slot];
+    if (ctx) {
+        return ctx;
+    }
+    const BatchOptions *options = worker->batch->options;
+    ctx = lz_context_new(algo, options->max_level);
+    if (!ctx) {
+        return NULL;
+    }
+    if (dict && lz_context_set_dict(ctx, options->dict) < 0) {
+        lz_context_free(ctx);
+        return NULL;
+    }
+    ctx->filter = options->filter;
+    if (!options->decompress && lz_context_set_level(ctx, options->level) < 0) {
+        lz_context_free(ctx);
+        return NULL;
+    }
+    ctx->target_speed = options->target_speed;
+    if (options->stats) {
+        lz_context_set_stats(ctx, &worker->stats);
+    }
+    worker->contexts[dict][slot] = ctx;
+    return ctx;
+}
+
+// Attaches the worker's writer, and its reader with `block_size` > 0, to this file's streams.
+int batch_attach(BatchWorker *worker, FILE *input_file, size_t block_size, FILE *output_file, size_t write_size) {
+    if (block_size > 0) {
+        if (!worker->reader) {
+            worker->reader = aio_reader_new(input_file, block_size);
+        } else if (aio_reader_attach(worker->reader, input_file) < 0) {
+            return -1;
+        }
+        if (!worker->reader) {
+            return -1;
+        }
+    }
+    if (!worker->writer) {
+        worker->writer = aio_writer_new(output_file, write_size);
+        return worker->writer ? 0 : -1;
+    }
+    return aio_writer_attach(worker->writer, output_file, write_size);
+}
+
+// Waits for anything still in flight on the file's streams, so that they can be closed.
+void batch_detach(BatchWorker *worker) {
+    if (worker->reader) {
+        aio_reader_detach(worker->reader);
+    }
+    if (worker->writer) {
+        aio_writer_detach(worker->writer);
+    }
+}
+
+// Returns an error message, or NULL on success.
+const char *batch_compress_file(BatchWorker *worker, FILE *input_file, FILE *output_file) {
+    const BatchOptions *options = worker->batch->options;
+    FrameHeader header = options->header;
+    header.algo = options->algo;
+    if (options->dict) {
+        header.flags |= FRAME_FLAG_DICT;
+        header.dict_id = options->dict->id;
+    }
+    LZ_Context *ctx = batch_context(worker, options->algo, options->dict);
+    if (!ctx) {
+        return "lz_context_new failed";
+    }
+    if (options->verify && !worker->verifier) {
+        worker->verifier = verify_new(options->algo, options->dict);
+        if (!worker->verifier) {
+            return "verify_new failed";
+        }
+    }
+    ctx->verifier = worker->verifier;
+    // --long reads the input whole.
+    size_t block_size = header.flags & FRAME_FLAG_LONG ? 0 : header.block_size;
+    if (batch_attach(worker, input_file, block_size, output_file, frame_write_size(&header)) < 0) {
+        return "I/O setup failed";
+    }
+    if (frame_compress_io(ctx, &header, input_file, worker->reader, worker->writer) < 0) {
+        uint64_t offset;
+        if (ctx->verifier && verify_failed(ctx->verifier, &offset)) {
+            return "--verify: output does not decompress to the input";
+        }
+        return "frame_compress failed";
+    }
+    return NULL;
+}
+
+const char *batch_decompress_file(BatchWorker *worker, FILE *input_file, FILE *output_file) {
+    const BatchOptions *options = worker->batch->options;
+    FrameHeader header;
+    if (frame_header_read(&header, input_file) < 0) {
+        return "input is not an lz frame";
+    }
+    bool dict = header.flags & FRAME_FLAG_DICT;
+    if (dict && (!options->dict || options->dict->id != header.dict_id)) {
+        return "input needs another dictionary";
+    }
+    size_t share = worker->batch->memory_share;
+    if (share > 0 && frame_decompress_memory_needed(&header, input_file) > share) {
+        return "input needs more memory than --max-memory leaves each job";
+    }
+    LZ_Context *ctx = batch_context(worker, header.algo, dict);
+    if (!ctx) {
+        return "lz_context_new failed";
+    }
+    if (batch_attach(worker, input_file, 0, output_file, frame_write_size(&header)) < 0) {
+        return "I/O setup failed";
+    }
+    return frame_decompress_io(ctx, &header, input_file, worker->writer) < 0 ? "frame_decompress failed" : NULL;
+}
+
+void batch_process(BatchWorker *worker, const char *path) {
+    const BatchOptions *options = worker->batch->options;
+    const char *message = NULL;
+    FILE *input_file = NULL;
+    FILE *output_file = NULL;
+    char *output_path = NULL;
+    bool created = false;
+
+    output_path = batch_output_path(path, options->decompress);
+    if (!output_path) {
+        message = options->decompress ? "name does not end in " BATCH_SUFFIX : "out of memory";
+        goto cleanup;
+    }
+    input_file = fopen(path, "r");
+    if (!input_file) {
+        message = "open failed";
+        goto cleanup;
+    }
+    // Existing files are never replaced, so a failed file cannot destroy one.
+    output_file = fopen(output_path, "wx");
+    if (!output_file) {
+        message = "output open failed (it may already exist)";
+        goto cleanup;
+    }
+    created = true;
+    if (options->decompress) {
+        message = batch_decompress_file(worker, input_file, output_file);
+    } else {
+        message = batch_compress_file(worker, input_file, output_file);
+    }
+    batch_detach(worker);
+    if (!message && fclose(output_file) != 0) {
+        message = "output write failed";
+    }
+    output_file = NULL;
+
+cleanup:
+    if (input_file) {
+        fclose(input_file);
+    }
+    if (output_file) {
+        fclose(output_file);
+    }
+    if (message) {
+        // A partial output is worse than none.
+        if (created) {
+            remove(output_path);
+        }
+        fprintf(stderr, "error: '%s': %s\n", path, message);
+        pthread_mutex_lock(&worker->batch->lock);
+        worker->batch->failures += 1;
+        pthread_mutex_unlock(&worker->batch->lock);
+    }
+    mem_free(output_path);
+}
+
+void *batch_worker_main(void *worker_) {
+    BatchWorker *worker = worker_;
+    Batch *batch = worker->batch;
+    while (true) {
+        pthread_mutex_lock(&batch->lock);
+        size_t i = batch->next < batch->count ? batch->next++ : batch->count;
+        pthread_mutex_unlock(&batch->lock);
+        if (i == batch->count) {
+            break;
+        }
+        batch_process(worker, batch->paths[i]);
+    }
+    return NULL;
+}
+
+// Returns -1 when any file failed (after trying all of them).
+int batch_run(const BatchOptions *options, const char *const *paths, size_t count) {
+    Batch batch = {.options = options, .paths = paths, .count = count};
+    // Checked once here rather than failing every file.
+    if (!options->decompress && (options->level < LZ77_LEVEL_MIN || options->level > options->max_level)) {
+        fprintf(stderr, "error: invalid level %d\n", options->level);
+        return -1;
+    }
+    if (pthread_mutex_init(&batch.lock, NULL) != 0) {
+        return -1;
+    }
+    size_t jobs = options->jobs;
+    if (jobs == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = online > 0 ? (size_t)online : 1;
+    }
+    if (jobs > count) {
+        jobs = count > 0 ? count : 1;
+    }
+    if (mem_limit() > 0) {
+        // Only as many workers as the budget holds, each sized by the options' block size.
+        FrameHeader header = options->header;
+        header.algo = options->algo;
+        size_t available = mem_limit() > mem_used() ? mem_limit() - mem_used() : 0;
+        FrameMemory use = options->verify ? FRAME_MEMORY_VERIFY : FRAME_MEMORY_COMPRESS;
+        if (options->decompress) {
+            use = FRAME_MEMORY_DECOMPRESS;
+        }
+        size_t fit = available / frame_memory_needed(&header, use, options->max_level);
+        if (jobs > fit) {
+            jobs = fit > 0 ? fit : 1;
+        }
+        batch.memory_share = available / jobs;
+    }
+    BatchWorker *workers = mem_calloc(jobs, sizeof(BatchWorker));
+    if (!workers) {
+        pthread_mutex_destroy(&batch.lock);
+        return -1;
+    }
+
+    // The calling thread is the first worker.
+    size_t started = 1;
+    for (size_t i = 0; i < jobs; ++i) {
+        workers[i].batch = &batch;
+    }
+    for (; started < jobs; ++started) {
+        if (pthread_create(&workers[started].thread, NULL, batch_worker_main, &workers[started]) != 0) {
+            break;
+        }
+    }
+    batch_worker_main(&workers[0]);
+    for (size_t i = 1; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < jobs; ++i) {
+        if (options->stats) {
+            stats_merge(options->stats, &workers[i].stats);
+        }
+        for (size_t dict = 0; dict < 2; ++dict) {
+            for (size_t slot = 0; slot <= ALGO_CODEC_COUNT; ++slot) {
+                if (workers[i].contexts[dict][slot]) {
+                    lz_context_free(workers[i].contexts[dict][slot]);
+                }
+            }
+        }
+        verify_free(workers[i].verifier);
+        if (workers[i].reader) {
+            aio_reader_free(workers[i].reader);
+        }
+        if (workers[i].writer) {
+            aio_writer_free(workers[i].writer);
+        }
+    }
+    mem_free(workers);
+    pthread_mutex_destroy(&batch.lock);
+    return batch.failures > 0 ? -1 : 0;
+}
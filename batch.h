@@ -0,0 +1,43 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "dict.h"
+#include "frame.h"
+#include "lz.h"
+#include "stats.h"
+
+#define BATCH_SUFFIX ".lz"
+
+// Settings shared by every file of a batch. `header` supplies the flags and block size for
+// compression; `stats`, when set, receives the totals over all files. `verify` decodes every
+// compressed block again and fails the file if it does not match. `target_speed` is in bytes
+// per second; every worker tunes its own level, starting from `level` and carrying it from
+// one file to the next. The LZ77 tables are sized for levels up to `max_level`.
+typedef struct {
+    bool decompress;
+    Algo algo;
+    Filter filter;
+    int level;
+    int max_level;
+    bool verify;
+    double target_speed;
+    FrameHeader header;
+    const Dict *dict;
+    size_t jobs;
+    Stats *stats;
+} BatchOptions;
+
+char **batch_read_list(FILE *stream, size_t *count);
+
+void batch_free_list(char **paths, size_t count);
+
+int batch_run(const BatchOptions *options, const char *const *paths, size_t count);
+
+#endif // BATCH_H
@@ -0,0 +1,109 @@
+#!/bin/sh
+# SPDX-License-Identifier: MIT
+# Copyright (c) 2025 Saleh Zaidan
+
+# Round-trips a few generated inputs through every algorithm, filter and mode of the lz binary
+# (./lz, or $LZ) and reports the combinations that fail. Run through `make check`.
+
+LZ=${LZ:-./lz}
+CC=${CC:-cc}
+# A run that hangs counts as a failure rather than stalling the check.
+TIMEOUT=
+if command -v timeout > /dev/null; then
+    TIMEOUT="timeout 60"
+fi
+ALGOS="LZ77 LZ78 LZW LZAP auto"
+FILTERS="none delta:1 shuffle:4 x86 auto"
+MODES="plain -C --long --seekable --verify"
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+: > "$dir/empty"
+printf 'a' > "$dir/byte"
+head -c 200000 /dev/zero > "$dir/zeros"
+head -c 100000 /dev/urandom > "$dir/random"
+cat README.md lz.c lz77.c > "$dir/text"
+
+# Picks every byte, where it can, so that the --long gear hash makes an anchor there: far more
+# distinct anchors than the anchor table was sized for.
+cat > "$dir/gen.c" << 'EOF'
+#include <stdint.h>
+#include <stdio.h>
+
+void dedup_gear_init(uint64_t *gear);
+
+int main(void) {
+    uint64_t gear[256];
+    dedup_gear_init(gear);
+    uint64_t hash = 0;
+    uint64_t state = 1;
+    for (int i = 0; i < 200000; ++i) {
+        state = state * 6364136223846793005u + 1442695040888963407u;
+        int byte = state >> 56;
+        for (int k = 0; k < 256; ++k) {
+            if (((hash << 1) + gear[(byte + k) & 0xFF]) >> 55 == 0) {
+                byte = (byte + k) & 0xFF;
+                break;
+            }
+        }
+        hash = (hash << 1) + gear[byte];
+        putchar(byte);
+    }
+    return 0;
+}
+EOF
+"$CC" -std=c11 -o "$dir/gen" "$dir/gen.c" dedup.c mem.c string.c || exit 1
+"$dir/gen" > "$dir/anchors" || exit 1
+
+INPUTS="empty byte zeros random text anchors"
+
+runs=0
+failed=0
+
+fail() {
+    failed=$((failed + 1))
+    echo "FAIL: $*"
+}
+
+for algo in $ALGOS; do
+    for filter in $FILTERS; do
+        for mode in $MODES; do
+            flags="-a $algo --filter $filter"
+            if [ "$mode" != plain ]; then
+                flags="$flags $mode"
+            fi
+            for input in $INPUTS; do
+                in="$dir/$input"
+                rm -f "$dir/out.lz" "$dir/out"
+                runs=$((runs + 1))
+                if ! $TIMEOUT "$LZ" $flags "$in" "$dir/out.lz" 2> "$dir/err"; then
+                    fail "$input $flags: compress: $(cat "$dir/err")"
+                    continue
+                fi
+                if ! $TIMEOUT "$LZ" -d "$dir/out.lz" "$dir/out" 2> "$dir/err"; then
+                    fail "$input $flags: decompress: $(cat "$dir/err")"
+                    continue
+                fi
+                if ! cmp -s "$in" "$dir/out"; then
+                    fail "$input $flags: output differs"
+                    continue
+                fi
+                size=$(wc -c < "$in")
+                if [ "$mode" = --seekable ] && [ "$size" -ge 3 ]; then
+                    start=$((size / 3))
+                    length=$((size / 3))
+                    rm -f "$dir/out"
+                    tail -c +$((start + 1)) "$in" | head -c $length > "$dir/part"
+                    if ! $TIMEOUT "$LZ" -d --range $start:$length "$dir/out.lz" "$dir/out" 2> "$dir/err" ||
+                        ! cmp -s "$dir/part" "$dir/out"; then
+                        fail "$input $flags: range $start:$length $(cat "$dir/err")"
+                    fi
+                fi
+            done
+        done
+    done
+done
+
+echo "$((runs - failed))/$runs round trips passed"
+[ $failed -eq 0 ]
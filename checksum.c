@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checksum.h"
+#include "mem.h"
+#include "string.h"
+
+// checksum32() and checksum64() are XXH32 and XXH64 with a seed of 0, so their values can be
+// checked with any xxHash tool. Both keep four independent accumulators over 16 or 32 byte
+// stripes; the lanes have no dependency on each other, so they run in parallel in the CPU
+// (and the compiler may put them in one vector register) at close to memory speed.
+
+#define CHECKSUM32_PRIME1 0x9E3779B1u
+#define CHECKSUM32_PRIME2 0x85EBCA77u
+#define CHECKSUM32_PRIME3 0xC2B2AE3Du
+#define CHECKSUM32_PRIME4 0x27D4EB2Fu
+#define CHECKSUM32_PRIME5 0x165667B1u
+#define CHECKSUM64_PRIME1 0x9E3779B185EBCA87ull
+#define CHECKSUM64_PRIME2 0xC2B2AE3D27D4EB4Full
+#define CHECKSUM64_PRIME3 0x165667B19E3779F9ull
+#define CHECKSUM64_PRIME4 0x85EBCA77C2B2AE63ull
+#define CHECKSUM64_PRIME5 0x27D4EB2F165667C5ull
+#define CHECKSUM_CHECKER_DEPTH 2
+
+uint32_t checksum_rotl32(uint32_t value, int bits) {
+    return (value << bits) | (value >> (32 - bits));
+}
+
+uint64_t checksum_rotl64(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+// xxHash reads its input little-endian, whatever the host; compilers turn these into plain loads.
+uint32_t checksum_read32(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+uint64_t checksum_read64(const uint8_t *p) {
+    return (uint64_t)checksum_read32(p) | (uint64_t)checksum_read32(p + 4) << 32;
+}
+
+uint32_t checksum32_round(uint32_t acc, uint32_t input) {
+    return checksum_rotl32(acc + input * CHECKSUM32_PRIME2, 13) * CHECKSUM32_PRIME1;
+}
+
+uint32_t checksum32(const void *data, size_t length) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + length;
+    uint32_t hash;
+    if (length >= 16) {
+        uint32_t v1 = CHECKSUM32_PRIME1 + CHECKSUM32_PRIME2;
+        uint32_t v2 = CHECKSUM32_PRIME2;
+        uint32_t v3 = 0;
+        uint32_t v4 = -CHECKSUM32_PRIME1;
+        for (; end - p >= 16; p += 16) {
+            v1 = checksum32_round(v1, checksum_read32(p));
+            v2 = checksum32_round(v2, checksum_read32(p + 4));
+            v3 = checksum32_round(v3, checksum_read32(p + 8));
+            v4 = checksum32_round(v4, checksum_read32(p + 12));
+        }
+        hash = checksum_rotl32(v1, 1) + checksum_rotl32(v2, 7) + checksum_rotl32(v3, 12) + checksum_rotl32(v4, 18);
+    } else {
+        hash = CHECKSUM32_PRIME5;
+    }
+    hash += (uint32_t)length;
+    for (; end - p >= 4; p += 4) {
+        hash = checksum_rotl32(hash + checksum_read32(p) * CHECKSUM32_PRIME3, 17) * CHECKSUM32_PRIME4;
+    }
+    for (; p < end; ++p) {
+        hash = checksum_rotl32(hash + *p * CHECKSUM32_PRIME5, 11) * CHECKSUM32_PRIME1;
+    }
+    hash ^= hash >> 15;
+    hash *= CHECKSUM32_PRIME2;
+    hash ^= hash >> 13;
+    hash *= CHECKSUM32_PRIME3;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+uint64_t checksum64_round(uint64_t acc, uint64_t input) {
+    return checksum_rotl64(acc + input * CHECKSUM64_PRIME2, 31) * CHECKSUM64_PRIME1;
+}
+
+uint64_t checksum64_merge(uint64_t hash, uint64_t acc) {
+    hash ^= checksum64_round(0, acc);
+    return hash * CHECKSUM64_PRIME1 + CHECKSUM64_PRIME4;
+}
+
+uint64_t checksum64(const void *data, size_t length) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + length;
+    uint64_t hash;
+    if (length >= 32) {
+        uint64_t v1 = CHECKSUM64_PRIME1 + CHECKSUM64_PRIME2;
+        uint64_t v2 = CHECKSUM64_PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -CHECKSUM64_PRIME1;
+        for (; end - p >= 32; p += 32) {
+            v1 = checksum64_round(v1, checksum_read64(p));
+            v2 = checksum64_round(v2, checksum_read64(p + 8));
+            v3 = checksum64_round(v3, checksum_read64(p + 16));
+            v4 = checksum64_round(v4, checksum_read64(p + 24));
+        }
+        hash = checksum_rotl64(v1, 1) + checksum_rotl64(v2, 7) + checksum_rotl64(v3, 12) + checksum_rotl64(v4, 18);
+        hash = checksum64_merge(hash, v1);
+        hash = checksum64_merge(hash, v2);
+        hash = checksum64_merge(hash, v3);
+        hash = checksum64_merge(hash, v4);
+    } else {
+        hash = CHECKSUM64_PRIME5;
+    }
+    hash += (uint64_t)length;
+    for (; end - p >= 8; p += 8) {
+        hash ^= checksum64_round(0, checksum_read64(p));
+        hash = checksum_rotl64(hash, 27) * CHECKSUM64_PRIME1 + CHECKSUM64_PRIME4;
+    }
+    if (end - p >= 4) {
+        hash ^= (uint64_t)checksum_read32(p) * CHECKSUM64_PRIME1;
+        hash = checksum_rotl64(hash, 23) * CHECKSUM64_PRIME2 + CHECKSUM64_PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        hash ^= *p * CHECKSUM64_PRIME5;
+        hash = checksum_rotl64(hash, 11) * CHECKSUM64_PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= CHECKSUM64_PRIME2;
+    hash ^= hash >> 29;
+    hash *= CHECKSUM64_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// A checker hashes decoded blocks on a thread of its own while the next block is decoded.
+// It takes each block over from the caller and frees it once checked.
+
+typedef struct {
+    String *data;
+    uint64_t expected;
+} ChecksumJob;
+
+typedef struct {
+    ChecksumJob jobs[CHECKSUM_CHECKER_DEPTH];
+    // jobs[head] is being (or about to be) checked; `count` slots from it are taken.
+    size_t head;
+    size_t count;
+    bool failed;
+    bool stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ChecksumChecker;
+
+void *checksum_checker_main(void *checker_) {
+    ChecksumChecker *checker = checker_;
+    pthread_mutex_lock(&checker->lock);
+    while (true) {
+        while (checker->count == 0 && !checker->stop) {
+            pthread_cond_wait(&checker->cond, &checker->lock);
+        }
+        if (checker->count == 0) {
+            break;
+        }
+        ChecksumJob *job = &checker->jobs[checker->head];
+        pthread_mutex_unlock(&checker->lock);
+        bool ok = checksum64(job->data->data, job->data->length) == job->expected;
+        string_free(job->data);
+        job->data = NULL;
+        pthread_mutex_lock(&checker->lock);
+        if (!ok) {
+            checker->failed = true;
+        }
+        checker->head = (checker->head + 1) % CHECKSUM_CHECKER_DEPTH;
+        checker->count -= 1;
+        pthread_cond_broadcast(&checker->cond);
+    }
+    pthread_mutex_unlock(&checker->lock);
+    return NULL;
+}
+
+void *checksum_checker_new(void) {
+    ChecksumChecker *checker = mem_alloc(sizeof(ChecksumChecker));
+    if (!checker) {
+        return NULL;
+    }
+    memset(checker, 0, sizeof(ChecksumChecker));
+    if (pthread_mutex_init(&checker->lock, NULL) != 0) {
+        mem_free(checker);
+        return NULL;
+    }
+    if (pthread_cond_init(&checker->cond, NULL) != 0) {
+        pthread_mutex_destroy(&checker->lock);
+        mem_free(checker);
+        return NULL;
+    }
+    if (pthread_create(&checker->thread, NULL, checksum_checker_main, checker) != 0) {
+        pthread_cond_destroy(&checker->cond);
+        pthread_mutex_destroy(&checker->lock);
+        mem_free(checker);
+        return NULL;
+    }
+    return checker;
+}
+
+// Queues `data` to be compared with checksum64() `expected`, waiting while the queue is full.
+// `data` belongs to the checker from here on, even on error. Returns -1 once a block has
+// failed, so the caller can stop early.
+int checksum_checker_submit(void *checker_, String *data, uint64_t expected) {
+    ChecksumChecker *checker = checker_;
+    pthread_mutex_lock(&checker->lock);
+    while (checker->count == CHECKSUM_CHECKER_DEPTH && !checker->failed) {
+        pthread_cond_wait(&checker->cond, &checker->lock);
+    }
+    if (checker->failed) {
+        pthread_mutex_unlock(&checker->lock);
+        string_free(data);
+        return -1;
+    }
+    ChecksumJob *job = &checker->jobs[(checker->head + checker->count) % CHECKSUM_CHECKER_DEPTH];
+    job->data = data;
+    job->expected = expected;
+    checker->count += 1;
+    pthread_cond_broadcast(&checker->cond);
+    pthread_mutex_unlock(&checker->lock);
+    return 0;
+}
+
+// Waits until every queued block is checked. Returns -1 if any of them did not match.
+int checksum_checker_finish(void *checker_) {
+    ChecksumChecker *checker = checker_;
+    pthread_mutex_lock(&checker->lock);
+    while (checker->count > 0) {
+        pthread_cond_wait(&checker->cond, &checker->lock);
+    }
+    bool failed = checker->failed;
+    pthread_mutex_unlock(&checker->lock);
+    return failed ? -1 : 0;
+}
+
+void checksum_checker_free(void *checker_) {
+    ChecksumChecker *checker = checker_;
+    if (!checker) {
+        return;
+    }
+    // The thread drains whatever is still queued before it stops.
+    pthread_mutex_lock(&checker->lock);
+    checker->stop = true;
+    pthread_cond_broadcast(&checker->cond);
+    pthread_mutex_unlock(&checker->lock);
+    pthread_join(checker->thread, NULL);
+    pthread_cond_destroy(&checker->cond);
+    pthread_mutex_destroy(&checker->lock);
+    mem_free(checker);
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "string.h"
+
+uint32_t checksum32(const void *data, size_t length);
+
+uint64_t checksum64(const void *data, size_t length);
+
+void *checksum_checker_new(void);
+
+int checksum_checker_submit(void *checker, String *data, uint64_t expected);
+
+int checksum_checker_finish(void *checker);
+
+void checksum_checker_free(void *checker);
+
+#endif // CHECKSUM_H
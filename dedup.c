@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dedup.h"
+#include "mem.h"
+#include "string.h"
+
+// A gear hash covers the last 64 bytes: every step shifts the older bytes one bit further
+// out. Its top bits pick content-defined anchors (one per 2^DEDUP_ANCHOR_BITS bytes on
+// average), so a repeated segment gets the same anchors wherever it occurs, however far
+// apart. Only anchors are remembered, which keeps the table at a few bytes per KiB of input.
+#define DEDUP_ANCHOR_BITS 9
+#define DEDUP_WINDOW 64
+#define DEDUP_PROBES 8
+
+typedef struct {
+    uint64_t fingerprint;
+    uint64_t position;
+} DedupAnchor;
+
+void dedup_gear_init(uint64_t *gear) {
+    // splitmix64, so the table is fixed without spelling out 256 constants.
+    uint64_t state = 0x9E3779B97F4A7C15u;
+    for (size_t i = 0; i < 256; ++i) {
+        uint64_t value = (state += 0x9E3779B97F4A7C15u);
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9u;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBu;
+        gear[i] = value ^ (value >> 31);
+    }
+}
+
+// Looks up the anchor with this fingerprint and replaces it with `position`, so later
+// matches prefer the nearest copy. Positions are stored as `i + 1` (0 means empty). The table
+// never grows, and input can have far more anchors than it was sized for, so the search stops
+// after DEDUP_PROBES slots and the anchor then takes over the slot it hashes to.
+uint64_t dedup_anchor_swap(DedupAnchor *table, size_t mask, uint64_t fingerprint, uint64_t position) {
+    size_t home = (fingerprint * 0x9E3779B97F4A7C15u) >> 32 & mask;
+    size_t slot = home;
+    for (size_t probe = 0; table[slot].position != 0 && table[slot].fingerprint != fingerprint; ++probe) {
+        if (probe == DEDUP_PROBES) {
+            slot = home;
+            table[slot].position = 0;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    uint64_t previous = table[slot].position;
+    table[slot].fingerprint = fingerprint;
+    table[slot].position = position + 1;
+    return previous;
+}
+
+// Finds segments of at least DEDUP_MIN_MATCH bytes that repeat earlier input at any
+// distance. Matches are returned in order and never overlap each other.
+int dedup_find(const String *input, DedupMatch **matches, size_t *count) {
+    bool error = false;
+    DedupAnchor *table = NULL;
+    DedupMatch *list = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+
+    const uint8_t *data = input->data;
+    size_t n = input->length;
+
+    size_t table_size = 1024;
+    while (table_size < (n >> DEDUP_ANCHOR_BITS) * 2) {
+        table_size *= 2;
+    }
+    table = mem_map(sizeof(DedupAnchor) * table_size);
+    if (!table) {
+        error = true;
+        goto cleanup;
+    }
+    uint64_t gear[256];
+    dedup_gear_init(gear);
+
+    uint64_t hash = 0;
+    size_t literal_start = 0;
+    size_t filled = 0;
+    for (size_t i = 0; i < n; ++i) {
+        hash = (hash << 1) + gear[data[i]];
+        if (++filled < DEDUP_WINDOW || hash >> (64 - DEDUP_ANCHOR_BITS) != 0) {
+            continue;
+        }
+        uint64_t previous = dedup_anchor_swap(table, table_size - 1, hash, i);
+        if (previous == 0) {
+            continue;
+        }
+
+        // Both windows end at their anchor; grow the match in both directions.
+        size_t cur = i + 1;
+        size_t src = previous;
+        size_t back = 0;
+        while (back < cur - literal_start && back < src && data[cur - back - 1] == data[src - back - 1]) {
+            back += 1;
+        }
+        size_t forward = 0;
+        while (cur + forward < n && back + forward < UINT32_MAX && data[cur + forward] == data[src + forward]) {
+            forward += 1;
+        }
+        if (back + forward < DEDUP_MIN_MATCH) {
+            continue;
+        }
+
+        if (length == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            DedupMatch *grown = mem_realloc(list, sizeof(DedupMatch) * capacity);
+            if (!grown) {
+                error = true;
+                goto cleanup;
+            }
+            list = grown;
+        }
+        list[length++] = (DedupMatch){
+            .start = cur - back,
+            .source = src - back,
+            .length = back + forward,
+        };
+        // The matched bytes are already covered; hashing resumes after them.
+        literal_start = cur + forward;
+        i = literal_start - 1;
+        hash = 0;
+        filled = 0;
+    }
+
+cleanup:
+    mem_unmap(table, sizeof(DedupAnchor) * table_size);
+    if (error) {
+        mem_free(list);
+        return -1;
+    }
+    *matches = list;
+    *count = length;
+    return 0;
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "string.h"
+
+#define DEDUP_MIN_MATCH 1024
+
+// `length` bytes at `start` repeat the bytes at `source`, which lies before `start` (the two
+// may overlap).
+typedef struct {
+    uint64_t start;
+    uint64_t source;
+    uint32_t length;
+} DedupMatch;
+
+int dedup_find(const String *input, DedupMatch **matches, size_t *count);
+
+#endif // DEDUP_H
@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "lz.h"
+#include "mem.h"
+#include "string.h"
+
+#define DICT_MAGIC "LZD\x01"
+#define DICT_MAGIC_SIZE 4
+#define DICT_KMER 8
+#define DICT_SEGMENT 64
+#define DICT_HASH_BITS 20
+#define DICT_HASH_SIZE (1 << DICT_HASH_BITS)
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    uint64_t score;
+} DictSegment;
+
+uint32_t dict_id(const String *content) {
+    // FNV-1a; 0 is reserved for "no dictionary".
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < content->length; ++i) {
+        hash = (hash ^ content->data[i]) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+uint32_t dict_hash_kmer(const uint8_t *data) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < DICT_KMER; ++i) {
+        value = value << 8 | data[i];
+    }
+    return (value * 0x9E3779B97F4A7C15ull) >> (64 - DICT_HASH_BITS);
+}
+
+uint64_t dict_segment_score(const DictSegment *segment, const uint32_t *counts) {
+    uint64_t score = 0;
+    for (size_t i = 0; i + DICT_KMER <= segment->length; ++i) {
+        uint32_t count = counts[dict_hash_kmer(segment->data + i)];
+        if (count > 1) {
+            score += count;
+        }
+    }
+    return score;
+}
+
+int dict_segment_compare(const void *a, const void *b) {
+    const DictSegment *sa = a;
+    const DictSegment *sb = b;
+    return (sa->score < sb->score) - (sa->score > sb->score);
+}
+
+// Picks the fixed-size segments of the samples whose 8-byte substrings recur most often.
+// Substrings already covered by a chosen segment stop counting, so the result is not made of
+// near-duplicates. The best segments go last, where LZ77 reaches them with the shortest offsets.
+Dict *dict_train(String *const *samples, size_t count, size_t size) {
+    bool error = false;
+    Dict *dict = NULL;
+    uint32_t *counts = NULL;
+    DictSegment *segments = NULL;
+    size_t *chosen = NULL;
+
+    counts = mem_calloc(DICT_HASH_SIZE, sizeof(uint32_t));
+    if (!counts) {
+        error = true;
+        goto cleanup;
+    }
+    size_t segment_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const String *sample = samples[i];
+        for (size_t j = 0; j + DICT_KMER <= sample->length; ++j) {
+            counts[dict_hash_kmer(sample->data + j)] += 1;
+        }
+        segment_count += (sample->length + DICT_SEGMENT - 1) / DICT_SEGMENT;
+    }
+
+    segments = mem_alloc(sizeof(DictSegment) * (segment_count + 1));
+    chosen = mem_alloc(sizeof(size_t) * (segment_count + 1));
+    if (!segments || !chosen) {
+        error = true;
+        goto cleanup;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const String *sample = samples[i];
+        for (size_t offset = 0; offset < sample->length; offset += DICT_SEGMENT) {
+            DictSegment *segment = &segments[n++];
+            segment->data = sample->data + offset;
+            segment->length = sample->length - offset < DICT_SEGMENT ? sample->length - offset : DICT_SEGMENT;
+            segment->score = dict_segment_score(segment, counts);
+        }
+    }
+    qsort(segments, n, sizeof(DictSegment), dict_segment_compare);
+
+    size_t chosen_count = 0;
+    size_t total = 0;
+    for (size_t i = 0; i < n && total < size; ++i) {
+        DictSegment *segment = &segments[i];
+        if (segment->score == 0 || dict_segment_score(segment, counts) == 0) {
+            continue;
+        }
+        if (segment->length > size - total) {
+            segment->length = size - total;
+        }
+        for (size_t j = 0; j + DICT_KMER <= segment->length; ++j) {
+            counts[dict_hash_kmer(segment->data + j)] = 0;
+        }
+        chosen[chosen_count++] = i;
+        total += segment->length;
+    }
+
+    dict = mem_alloc(sizeof(Dict));
+    if (!dict) {
+        error = true;
+        goto cleanup;
+    }
+    dict->content = string_with_capacity(total + 1);
+    if (!dict->content) {
+        error = true;
+        goto cleanup;
+    }
+    for (size_t i = chosen_count; i-- > 0;) {
+        const DictSegment *segment = &segments[chosen[i]];
+        memcpy(dict->content->data + dict->content->length, segment->data, segment->length);
+        dict->content->length += segment->length;
+    }
+    dict->content->data[dict->content->length] = '\0';
+    dict->id = dict_id(dict->content);
+
+cleanup:
+    mem_free(counts);
+    mem_free(segments);
+    mem_free(chosen);
+    if (error) {
+        dict_free(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+Dict *dict_from_stream(FILE *stream) {
+    bool error = false;
+    Dict *dict = NULL;
+
+    uint8_t header[DICT_MAGIC_SIZE + 8];
+    if (fread(header, 1, sizeof(header), stream) != sizeof(header) ||
+        memcmp(header, DICT_MAGIC, DICT_MAGIC_SIZE) != 0) {
+        error = true;
+        goto cleanup;
+    }
+    dict = mem_alloc(sizeof(Dict));
+    if (!dict) {
+        error = true;
+        goto cleanup;
+    }
+    dict->id = uint32_be_read(header + DICT_MAGIC_SIZE);
+    size_t length = uint32_be_read(header + DICT_MAGIC_SIZE + 4);
+    dict->content = string_with_capacity(length + 1);
+    if (!dict->content) {
+        error = true;
+        goto cleanup;
+    }
+    if (fread(dict->content->data, 1, length, stream) != length) {
+        error = true;
+        goto cleanup;
+    }
+    dict->content->length = length;
+    dict->content->data[length] = '\0';
+    if (dict_id(dict->content) != dict->id) {
+        error = true;
+        goto cleanup;
+    }
+
+cleanup:
+    if (error) {
+        dict_free(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+int dict_write(const Dict *dict, FILE *stream) {
+    uint8_t header[DICT_MAGIC_SIZE + 8];
+    memcpy(header, DICT_MAGIC, DICT_MAGIC_SIZE);
+    uint32_be_write(header + DICT_MAGIC_SIZE, dict->id);
+    uint32_be_write(header + DICT_MAGIC_SIZE + 4, dict->content->length);
+    if (fwrite(header, 1, sizeof(header), stream) != sizeof(header)) {
+        return -1;
+    }
+    size_t written = fwrite(dict->content->data, 1, dict->content->length, stream);
+    if (written != dict->content->length) {
+        return -1;
+    }
+    return 0;
+}
+
+void dict_free(Dict *dict) {
+    if (!dict) {
+        return;
+    }
+    if (dict->content) {
+        string_free(dict->content);
+    }
+    mem_free(dict);
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef DICT_H
+#define DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "string.h"
+
+#define DICT_DEFAULT_SIZE (16 * 1024)
+
+typedef struct {
+    uint32_t id;
+    String *content;
+} Dict;
+
+Dict *dict_train(String *const *samples, size_t count, size_t size);
+
+Dict *dict_from_stream(FILE *stream);
+
+int dict_write(const Dict *dict, FILE *stream);
+
+void dict_free(Dict *dict);
+
+#endif // DICT_H
@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "filter.h"
+
+// delta:N    every byte minus the byte N positions earlier, which turns slowly changing
+//            N-byte integers into runs of small values.
+// shuffle:N  byte-plane transposition of N-byte elements: all first bytes, then all second
+//            bytes and so on, so that the (often constant) high bytes line up.
+// x86        the rel32 operand of every E8 (call) and E9 (jmp) byte is made absolute, so
+//            repeated calls to one function become repeated byte strings.
+// The SSE2 paths are used where the compiler targets it, with scalar code for the rest.
+
+const char *filter_names[FILTER_COUNT] = {
+    [FILTER_NONE] = "none",
+    [FILTER_DELTA1] = "delta:1",
+    [FILTER_DELTA2] = "delta:2",
+    [FILTER_DELTA4] = "delta:4",
+    [FILTER_DELTA8] = "delta:8",
+    [FILTER_SHUFFLE2] = "shuffle:2",
+    [FILTER_SHUFFLE4] = "shuffle:4",
+    [FILTER_SHUFFLE8] = "shuffle:8",
+    [FILTER_X86] = "x86",
+};
+
+int filter_parse(const char *name, Filter *filter) {
+    if (strcmp(name, "auto") == 0) {
+        *filter = FILTER_AUTO;
+        return 0;
+    }
+    for (Filter i = 0; i < FILTER_COUNT; ++i) {
+        if (strcmp(name, filter_names[i]) == 0) {
+            *filter = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+const char *filter_name(Filter filter) {
+    if (filter == FILTER_AUTO) {
+        return "auto";
+    }
+    return filter < FILTER_COUNT ? filter_names[filter] : NULL;
+}
+
+size_t filter_width(Filter filter) {
+    switch (filter) {
+    case FILTER_DELTA1:
+        return 1;
+    case FILTER_DELTA2:
+    case FILTER_SHUFFLE2:
+        return 2;
+    case FILTER_DELTA4:
+    case FILTER_SHUFFLE4:
+        return 4;
+    case FILTER_DELTA8:
+    case FILTER_SHUFFLE8:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+void filter_delta_encode(const uint8_t *src, uint8_t *dst, size_t length, size_t width) {
+    size_t i = 0;
+    for (; i < width && i < length; ++i) {
+        dst[i] = src[i];
+    }
+#if defined(__SSE2__)
+    for (; i + 16 <= length; i += 16) {
+        __m128i current = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i previous = _mm_loadu_si128((const __m128i *)(src + i - width));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_sub_epi8(current, previous));
+    }
+#endif
+    for (; i < length; ++i) {
+        dst[i] = src[i] - src[i - width];
+    }
+}
+
+#if defined(__SSE2__)
+// Prefix sums over lanes `width` bytes apart within a vector, plus the last element of the
+// previous vector broadcast into every lane.
+__m128i filter_delta_sum(__m128i x, __m128i carry, size_t width) {
+    switch (width) {
+    case 1:
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+        // fall through
+    case 2:
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+        // fall through
+    case 4:
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        // fall through
+    case 8:
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        break;
+    }
+    return _mm_add_epi8(x, carry);
+}
+
+__m128i filter_delta_carry(const uint8_t *last, size_t width) {
+    switch (width) {
+    case 1:
+        return _mm_set1_epi8(last[0]);
+    case 2: {
+        uint16_t value;
+        memcpy(&value, last, sizeof(value));
+        return _mm_set1_epi16(value);
+    }
+    case 4: {
+        uint32_t value;
+        memcpy(&value, last, sizeof(value));
+        return _mm_set1_epi32(value);
+    }
+    default: {
+        uint64_t value;
+        memcpy(&value, last, sizeof(value));
+        return _mm_set1_epi64x(value);
+    }
+    }
+}
+#endif
+
+void filter_delta_decode(const uint8_t *src, uint8_t *dst, size_t length, size_t width) {
+    size_t i = 0;
+    for (; i < width && i < length; ++i) {
+        dst[i] = src[i];
+    }
+#if defined(__SSE2__)
+    // Vectors must start on an element boundary for the broadcast carry to line up.
+    for (; i % 16 != 0 && i < length; ++i) {
+        dst[i] = src[i] + dst[i - width];
+    }
+    for (; i + 16 <= length; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i carry = filter_delta_carry(dst + i - width, width);
+        _mm_storeu_si128((__m128i *)(dst + i), filter_delta_sum(x, carry, width));
+    }
+#endif
+    for (; i < length; ++i) {
+        dst[i] = src[i] + dst[i - width];
+    }
+}
+
+#if defined(__SSE2__)
+// Splits `count` consecutive vectors into their even bytes (first half) and odd bytes
+// (second half). Applied log2(width) times this leaves the byte planes of width-byte
+// elements in bit-reversed order.
+void filter_deinterleave(__m128i *v, size_t count) {
+    __m128i mask = _mm_set1_epi16(0x00FF);
+    __m128i even[8];
+    __m128i odd[8];
+    for (size_t i = 0; i < count / 2; ++i) {
+        even[i] = _mm_packus_epi16(_mm_and_si128(v[2 * i], mask), _mm_and_si128(v[2 * i + 1], mask));
+        odd[i] = _mm_packus_epi16(_mm_srli_epi16(v[2 * i], 8), _mm_srli_epi16(v[2 * i + 1], 8));
+    }
+    for (size_t i = 0; i < count / 2; ++i) {
+        v[i] = even[i];
+        v[count / 2 + i] = odd[i];
+    }
+}
+
+// The inverse of filter_deinterleave.
+void filter_interleave(__m128i *v, size_t count) {
+    __m128i out[16];
+    for (size_t i = 0; i < count / 2; ++i) {
+        out[2 * i] = _mm_unpacklo_epi8(v[i], v[count / 2 + i]);
+        out[2 * i + 1] = _mm_unpackhi_epi8(v[i], v[count / 2 + i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        v[i] = out[i];
+    }
+}
+
+size_t filter_bit_reverse(size_t value, size_t bits) {
+    size_t result = 0;
+    for (size_t i = 0; i < bits; ++i) {
+        result = result << 1 | (value >> i & 1);
+    }
+    return result;
+}
+
+size_t filter_log2(size_t width) {
+    return width == 2 ? 1 : width == 4 ? 2 : 3;
+}
+#endif
+
+void filter_shuffle_encode(const uint8_t *src, uint8_t *dst, size_t length, size_t width) {
+    size_t elements = length / width;
+    size_t i = 0;
+#if defined(__SSE2__)
+    size_t bits = filter_log2(width);
+    for (; i + 16 <= elements; i += 16) {
+        __m128i v[8];
+        for (size_t j = 0; j < width; ++j) {
+            v[j] = _mm_loadu_si128((const __m128i *)(src + i * width + j * 16));
+        }
+        for (size_t level = 0, count = width; level < bits; ++level, count /= 2) {
+            for (size_t group = 0; group < width; group += count) {
+                filter_deinterleave(v + group, count);
+            }
+        }
+        for (size_t j = 0; j < width; ++j) {
+            _mm_storeu_si128((__m128i *)(dst + filter_bit_reverse(j, bits) * elements + i), v[j]);
+        }
+    }
+#endif
+    for (; i < elements; ++i) {
+        for (size_t plane = 0; plane < width; ++plane) {
+            dst[plane * elements + i] = src[i * width + plane];
+        }
+    }
+    memcpy(dst + elements * width, src + elements * width, length - elements * width);
+}
+
+void filter_shuffle_decode(const uint8_t *src, uint8_t *dst, size_t length, size_t width) {
+    size_t elements = length / width;
+    size_t i = 0;
+#if defined(__SSE2__)
+    size_t bits = filter_log2(width);
+    for (; i + 16 <= elements; i += 16) {
+        __m128i v[8];
+        for (size_t j = 0; j < width; ++j) {
+            v[j] = _mm_loadu_si128((const __m128i *)(src + filter_bit_reverse(j, bits) * elements + i));
+        }
+        for (size_t level = 0, count = 2; level < bits; ++level, count *= 2) {
+            for (size_t group = 0; group < width; group += count) {
+                filter_interleave(v + group, count);
+            }
+        }
+        for (size_t j = 0; j < width; ++j) {
+            _mm_storeu_si128((__m128i *)(dst + i * width + j * 16), v[j]);
+        }
+    }
+#endif
+    for (; i < elements; ++i) {
+        for (size_t plane = 0; plane < width; ++plane) {
+            dst[i * width + plane] = src[plane * elements + i];
+        }
+    }
+    memcpy(dst + elements * width, src + elements * width, length - elements * width);
+}
+
+// Positions are relative to the block, so blocks stay independent. Both directions skip the
+// same four operand bytes after every opcode, so they agree on which bytes are operands.
+void filter_x86(const uint8_t *src, uint8_t *dst, size_t length, bool encode) {
+    memcpy(dst, src, length);
+    size_t i = 0;
+    while (i + 5 <= length) {
+#if defined(__SSE2__)
+        if (i + 16 <= length) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE8)),
+                _mm_cmpeq_epi8(v, _mm_set1_epi8((char)0xE9)));
+            int mask = _mm_movemask_epi8(hits);
+            if (mask == 0) {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(mask);
+            if (i + 5 > length) {
+                break;
+            }
+        }
+#endif
+        if (src[i] != 0xE8 && src[i] != 0xE9) {
+            i += 1;
+            continue;
+        }
+        uint32_t value = (uint32_t)src[i + 1] | (uint32_t)src[i + 2] << 8 | (uint32_t)src[i + 3] << 16 |
+            (uint32_t)src[i + 4] << 24;
+        uint32_t next = i + 5;
+        value = encode ? value + next : value - next;
+        for (size_t j = 0; j < 4; ++j) {
+            dst[i + 1 + j] = value >> (8 * j);
+        }
+        i += 5;
+    }
+}
+
+void filter_encode(Filter filter, const uint8_t *src, uint8_t *dst, size_t length) {
+    switch (filter) {
+    case FILTER_DELTA1:
+    case FILTER_DELTA2:
+    case FILTER_DELTA4:
+    case FILTER_DELTA8:
+        filter_delta_encode(src, dst, length, filter_width(filter));
+        break;
+    case FILTER_SHUFFLE2:
+    case FILTER_SHUFFLE4:
+    case FILTER_SHUFFLE8:
+        filter_shuffle_encode(src, dst, length, filter_width(filter));
+        break;
+    case FILTER_X86:
+        filter_x86(src, dst, length, true);
+        break;
+    default:
+        memcpy(dst, src, length);
+        break;
+    }
+}
+
+void filter_decode(Filter filter, const uint8_t *src, uint8_t *dst, size_t length) {
+    switch (filter) {
+    case FILTER_DELTA1:
+    case FILTER_DELTA2:
+    case FILTER_DELTA4:
+    case FILTER_DELTA8:
+        filter_delta_decode(src, dst, length, filter_width(filter));
+        break;
+    case FILTER_SHUFFLE2:
+    case FILTER_SHUFFLE4:
+    case FILTER_SHUFFLE8:
+        filter_shuffle_decode(src, dst, length, filter_width(filter));
+        break;
+    case FILTER_X86:
+        filter_x86(src, dst, length, false);
+        break;
+    default:
+        memcpy(dst, src, length);
+        break;
+    }
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reversible transforms applied to a block before compression. The values are stored in the
+// block type, so they must not change.
+typedef enum {
+    FILTER_NONE,
+    FILTER_DELTA1,
+    FILTER_DELTA2,
+    FILTER_DELTA4,
+    FILTER_DELTA8,
+    FILTER_SHUFFLE2,
+    FILTER_SHUFFLE4,
+    FILTER_SHUFFLE8,
+    FILTER_X86,
+    FILTER_COUNT,
+    // Not a filter: picks one of the above for every block.
+    FILTER_AUTO = 0x80,
+} Filter;
+
+int filter_parse(const char *name, Filter *filter);
+
+const char *filter_name(Filter filter);
+
+void filter_encode(Filter filter, const uint8_t *src, uint8_t *dst, size_t length);
+
+void filter_decode(Filter filter, const uint8_t *src, uint8_t *dst, size_t length);
+
+#endif // FILTER_H
@@ -0,0 +1,1223 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aio.h"
+#include "checksum.h"
+#include "dedup.h"
+#include "filter.h"
+#include "frame.h"
+#include "lz.h"
+#include "mem.h"
+#include "stats.h"
+#include "string.h"
+#include "verify.h"
+
+#define FRAME_HEADER_MAX_SIZE (FRAME_MAGIC_SIZE + 10)
+#define BLOCK_HEADER_SIZE 9
+#define BLOCK_CHECKSUM_SIZE 12
+#define FRAME_INDEX_ENTRY_SIZE 16
+#define FRAME_INDEX_TRAILER_SIZE (4 + FRAME_INDEX_MAGIC_SIZE)
+#define FRAME_SAMPLE_CHUNKS 4
+#define FRAME_SAMPLE_CHUNK_SIZE 4096
+#define FRAME_SAMPLE_MIN_SIZE 1024
+#define FRAME_PROBE_BITS 12
+#define FRAME_TRIAL_CHUNKS 4
+#define FRAME_TRIAL_CHUNK_SIZE 16384
+#define FRAME_COPY_PAYLOAD_SIZE 8
+#define FRAME_FILTER_TRIAL_SIZE 65536
+#define FRAME_MIN_BLOCK_SIZE 4096
+// Block-sized buffers alive at once: while compressing, the reader's two, a filtered copy,
+// the payload and the LZ77 window and streams (the growing ones at twice their length);
+// while decompressing, the payload, the decoded block, an unfiltered copy and the block
+// still being written from.
+#define FRAME_COMPRESS_BLOCK_BUFFERS 9
+#define FRAME_DECOMPRESS_BLOCK_BUFFERS 4
+// Decoded blocks queued for (or being hashed by) the checksum checker.
+#define FRAME_CHECKSUM_BLOCK_BUFFERS 2
+// Allocations that do not follow the block size: the reader's and writer's state, the
+// checker's, and the like.
+#define FRAME_FIXED_MEMORY (16 << 10)
+// Decoding a frame with any of these copies its output through the writer's buffers rather
+// than handing the writer whole decoded blocks.
+#define FRAME_WRITE_COPY_FLAGS (FRAME_FLAG_CHECKSUM | FRAME_FLAG_LONG | FRAME_FLAG_SEEKABLE)
+// --target-speed steps up a level only with this much to spare, and lets a remembered speed
+// creep up by this factor per block so that a level once too slow is tried again later.
+#define FRAME_TUNE_HEADROOM 1.1
+#define FRAME_TUNE_RETRY 1.05
+
+// Frame layout:
+//   header   magic, algo (1), flags (1), [dict id (4)], block size (4)
+//   blocks   type (1), uncompressed size (4), compressed size (4), only with
+//            FRAME_FLAG_CHECKSUM checksum32() of the payload (4) and checksum64() of the
+//            uncompressed data (8), then the payload; the type is the
+//            algo, or FRAME_BLOCK_STORED for a payload holding the input as is, or (only with
+//            FRAME_FLAG_LONG) FRAME_BLOCK_COPY for a payload holding the offset (8) of earlier
+//            output to repeat; codec blocks carry the filter applied before compression in
+//            the upper bits (type = algo | filter << FRAME_BLOCK_FILTER_SHIFT)
+//   end      FRAME_BLOCK_END (1)
+//   index    only with FRAME_FLAG_SEEKABLE: per block the uncompressed offset (8) and the
+//            offset of its block header (8), then the entry count (4) and FRAME_INDEX_MAGIC.
+// All integers are big-endian. Apart from copy blocks, blocks never reference each other.
+
+// The index of a seekable frame as it is built, and the output offset so far.
+typedef struct {
+    bool enabled;
+    FrameIndexEntry *entries;
+    size_t length;
+    size_t capacity;
+    uint64_t offset;
+} FrameIndex;
+
+size_t frame_header_write_buf(const FrameHeader *header, uint8_t *buf) {
+    size_t length = FRAME_MAGIC_SIZE;
+    memcpy(buf, FRAME_MAGIC, FRAME_MAGIC_SIZE);
+    uint8_be_write(buf + length++, header->algo);
+    uint8_be_write(buf + length++, header->flags);
+    if (header->flags & FRAME_FLAG_DICT) {
+        uint32_be_write(buf + length, header->dict_id);
+        length += 4;
+    }
+    uint32_be_write(buf + length, header->block_size);
+    length += 4;
+    return length;
+}
+
+int frame_header_write(const FrameHeader *header, FILE *stream) {
+    uint8_t buf[FRAME_HEADER_MAX_SIZE];
+    size_t length = frame_header_write_buf(header, buf);
+    size_t written = fwrite(buf, 1, length, stream);
+    if (written != length) {
+        return -1;
+    }
+    return 0;
+}
+
+int frame_header_read(FrameHeader *header, FILE *stream) {
+    uint8_t buf[FRAME_MAGIC_SIZE + 2];
+    if (fread(buf, 1, sizeof(buf), stream) != sizeof(buf)) {
+        return -1;
+    }
+    if (memcmp(buf, FRAME_MAGIC, FRAME_MAGIC_SIZE) != 0) {
+        return -1;
+    }
+    uint8_t algo = uint8_be_read(buf + FRAME_MAGIC_SIZE);
+    if (algo >= ALGO_CODEC_COUNT && algo != ALGO_AUTO) {
+        return -1;
+    }
+    header->algo = algo;
+    header->flags = uint8_be_read(buf + FRAME_MAGIC_SIZE + 1);
+    header->dict_id = 0;
+    uint8_t value[4];
+    if (header->flags & FRAME_FLAG_DICT) {
+        if (fread(value, 1, sizeof(value), stream) != sizeof(value)) {
+            return -1;
+        }
+        header->dict_id = uint32_be_read(value);
+    }
+    if (fread(value, 1, sizeof(value), stream) != sizeof(value)) {
+        return -1;
+    }
+    header->block_size = uint32_be_read(value);
+    if (header->block_size == 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// What the writer buffers before handing it over: AIO_WRITE_SIZE bytes, or one block with its
+// header when blocks are smaller.
+size_t frame_write_size(const FrameHeader *header) {
+    size_t write_size = (size_t)header->block_size + BLOCK_HEADER_SIZE + BLOCK_CHECKSUM_SIZE;
+    return write_size < AIO_WRITE_SIZE ? write_size : AIO_WRITE_SIZE;
+}
+
+// An upper estimate of the memory needed to compress or decompress a frame, codec contexts
+// included, with LZ77 tables for levels up to `level` (decoding needs only the smallest).
+// A --long frame also keeps everything seen so far, which is not known upfront.
+size_t frame_memory_needed(const FrameHeader *header, FrameMemory use, int level) {
+    size_t block_size = header->block_size;
+    size_t buffers = use == FRAME_MEMORY_DECOMPRESS ? FRAME_DECOMPRESS_BLOCK_BUFFERS : FRAME_COMPRESS_BLOCK_BUFFERS;
+    if (use == FRAME_MEMORY_DECOMPRESS) {
+        level = LZ77_LEVEL_MIN;
+    }
+    size_t needed = FRAME_FIXED_MEMORY + lz_context_size(header->algo, level) + buffers * (block_size + 1);
+    // Each of the writer's two buffers holds frame_write_size() bytes, or one larger block
+    // with its header.
+    if (use != FRAME_MEMORY_DECOMPRESS || (header->flags & FRAME_WRITE_COPY_FLAGS)) {
+        needed += 2 * (block_size + BLOCK_HEADER_SIZE + BLOCK_CHECKSUM_SIZE + 1);
+    }
+    if (use == FRAME_MEMORY_DECOMPRESS && (header->flags & FRAME_FLAG_CHECKSUM)) {
+        needed += FRAME_CHECKSUM_BLOCK_BUFFERS * (block_size + 1);
+    }
+    if (use == FRAME_MEMORY_VERIFY) {
+        needed += lz_context_size(header->algo, LZ77_LEVEL_MIN) + verify_memory_needed(header);
+    }
+    return needed;
+}
+
+// The largest power-of-two block size up to the default whose frame_memory_needed() stays
+// within `budget`, or 0 if not even FRAME_MIN_BLOCK_SIZE does.
+uint32_t frame_block_size_for(const FrameHeader *header, FrameMemory use, int level, size_t budget) {
+    FrameHeader trial = *header;
+    for (trial.block_size = FRAME_DEFAULT_BLOCK_SIZE; trial.block_size >= FRAME_MIN_BLOCK_SIZE;
+         trial.block_size /= 2) {
+        if (frame_memory_needed(&trial, use, level) <= budget) {
+            return trial.block_size;
+        }
+    }
+    return 0;
+}
+
+size_t frame_block_header_size(const FrameHeader *header) {
+    return BLOCK_HEADER_SIZE + (header->flags & FRAME_FLAG_CHECKSUM ? BLOCK_CHECKSUM_SIZE : 0);
+}
+
+size_t frame_block_header_write_buf(const FrameHeader *header, const BlockHeader *block, uint8_t *buf) {
+    uint8_be_write(buf, block->type);
+    uint32_be_write(buf + 1, block->uncompressed_size);
+    uint32_be_write(buf + 5, block->compressed_size);
+    if (header->flags & FRAME_FLAG_CHECKSUM) {
+        uint32_be_write(buf + BLOCK_HEADER_SIZE, block->payload_checksum);
+        uint64_be_write(buf + BLOCK_HEADER_SIZE + 4, block->content_checksum);
+    }
+    return frame_block_header_size(header);
+}
+
+// Returns 1 on the end marker, 0 on a block header, -1 on error.
+int frame_block_header_read(const FrameHeader *header, BlockHeader *block, FILE *stream) {
+    uint8_t buf[BLOCK_HEADER_SIZE + BLOCK_CHECKSUM_SIZE];
+    if (fread(buf, 1, 1, stream) != 1) {
+        return -1;
+    }
+    block->type = uint8_be_read(buf);
+    if (block->type == FRAME_BLOCK_END) {
+        return 1;
+    }
+    size_t size = frame_block_header_size(header);
+    if (fread(buf + 1, 1, size - 1, stream) != size - 1) {
+        return -1;
+    }
+    block->uncompressed_size = uint32_be_read(buf + 1);
+    block->compressed_size = uint32_be_read(buf + 5);
+    block->payload_checksum = 0;
+    block->content_checksum = 0;
+    if (header->flags & FRAME_FLAG_CHECKSUM) {
+        block->payload_checksum = uint32_be_read(buf + BLOCK_HEADER_SIZE);
+        block->content_checksum = uint64_be_read(buf + BLOCK_HEADER_SIZE + 4);
+    }
+    return 0;
+}
+
+// frame_memory_needed() for decompressing the frame in `input`, whose header has been read,
+// sized by the blocks it really holds rather than the declared block size, so that a frame
+// smaller than that is not refused memory it will never use. The block headers are read
+// ahead and the position of `input` restored; when it cannot seek (a pipe) or they do not
+// parse, the declared block size is assumed. The --long history is known here as well.
+size_t frame_decompress_memory_needed(const FrameHeader *header, FILE *input) {
+    size_t fallback = frame_memory_needed(header, FRAME_MEMORY_DECOMPRESS, LZ77_LEVEL_MIN);
+    long position = ftell(input);
+    if (position < 0) {
+        return fallback;
+    }
+    size_t block_size = 0;
+    size_t payload_size = 0;
+    size_t blocks = 0;
+    size_t content = 0;
+    bool filtered = false;
+    bool error = false;
+    while (true) {
+        BlockHeader block;
+        int status = frame_block_header_read(header, &block, input);
+        if (status != 0) {
+            error = status < 0;
+            break;
+        }
+        content += block.uncompressed_size;
+        // Copy blocks only extend the --long history.
+        if (block.type != FRAME_BLOCK_COPY) {
+            block_size = block.uncompressed_size > block_size ? block.uncompressed_size : block_size;
+            payload_size = block.compressed_size > payload_size ? block.compressed_size : payload_size;
+            filtered |= block.type < FRAME_BLOCK_COPY && block.type >> FRAME_BLOCK_FILTER_SHIFT != FILTER_NONE;
+            blocks += 1;
+        }
+        if (fseek(input, block.compressed_size, SEEK_CUR) != 0) {
+            error = true;
+            break;
+        }
+    }
+    if (fseek(input, position, SEEK_SET) != 0 || error) {
+        return fallback;
+    }
+    // The payload is read into the context's scratch arena. The decoded block comes with an
+    // unfiltered copy if any block is filtered, and with the block before it while that one
+    // is still being written.
+    size_t needed = FRAME_FIXED_MEMORY + lz_context_size(header->algo, LZ77_LEVEL_MIN) +
+                    mem_arena_size_for(payload_size) + (1 + filtered + (blocks > 1)) * (block_size + 1);
+    if (header->flags & FRAME_WRITE_COPY_FLAGS) {
+        // The writer's buffers double up to frame_write_size() as output arrives, or take one
+        // larger block whole.
+        size_t write_size = frame_write_size(header) < 2 * content ? frame_write_size(header) : 2 * content;
+        needed += 2 * ((write_size > block_size ? write_size : block_size) + 1);
+    }
+    if (header->flags & FRAME_FLAG_CHECKSUM) {
+        needed += FRAME_CHECKSUM_BLOCK_BUFFERS * (block_size + 1);
+    }
+    // The history grows by doubling.
+    if (header->flags & FRAME_FLAG_LONG) {
+        needed += 2 * (content + 1);
+    }
+    return needed;
+}
+
+// Lists the tokens of an encoded payload for --debug-cr. Only this listing needs the tokens
+// materialized; compression and decoding work on the encoded bytes directly.
+int frame_debug_print(LZ_Context *ctx, Algo algo, const void *payload, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    FILE *payload_stream = fmemopen((void *)payload, length, "r");
+    if (!payload_stream) {
+        return -1;
+    }
+    void *compressed = lz_deserialize(algo, payload_stream);
+    fclose(payload_stream);
+    if (!compressed) {
+        return -1;
+    }
+    lz_print(algo, compressed, ctx->debug);
+    lz_free(algo, compressed);
+    return 0;
+}
+
+// Guesses from a few spread-out samples whether a block is not worth running a codec on:
+// its bytes must look near-uniform and 4-byte sequences must (almost) never repeat. The
+// byte test uses the collision entropy -log2(sum p^2), which is at most the Shannon entropy
+// and needs no floating point: it is at least 7.5 bits when sum(c^2) * 2^7.5 <= n^2.
+bool frame_block_incompressible(const String *block) {
+    if (block->length < FRAME_SAMPLE_MIN_SIZE) {
+        return false;
+    }
+    uint32_t histogram[256] = {0};
+    uint32_t probe[1 << FRAME_PROBE_BITS] = {0};
+    uint64_t samples = 0;
+    uint64_t repeats = 0;
+    size_t chunk_size = FRAME_SAMPLE_CHUNK_SIZE;
+    size_t chunks = FRAME_SAMPLE_CHUNKS;
+    if (block->length <= chunk_size * chunks) {
+        chunk_size = block->length;
+        chunks = 1;
+    }
+    const uint8_t *data = block->data;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        size_t start = chunks > 1 ? (block->length - chunk_size) / (chunks - 1) * chunk : 0;
+        for (size_t i = start; i < start + chunk_size; ++i) {
+            histogram[data[i]] += 1;
+            samples += 1;
+            if (i + 4 <= start + chunk_size) {
+                uint32_t value = uint32_be_read(data + i);
+                uint32_t hash = (value * 2654435761u) >> (32 - FRAME_PROBE_BITS);
+                repeats += probe[hash] == value;
+                probe[hash] = value;
+            }
+        }
+    }
+    uint64_t collisions = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        collisions += (uint64_t)histogram[i] * histogram[i];
+    }
+    return collisions * 181 <= samples * samples && repeats * 16 < samples;
+}
+
+// For ALGO_AUTO: compresses a sample of the block (a few spread-out chunks, or the whole
+// block when it is small) with every codec and returns the one with the smallest output.
+// Trials run without stats so that only the final encoding is counted; without stats, when
+// the sample is the whole block, its winning encoding is left in `payload` for reuse.
+int frame_block_choose(LZ_Context *ctx, const String *block, String *payload) {
+    bool error = false;
+    String *trial = NULL;
+    Stats *stats = ctx->stats;
+    int best = -1;
+
+    const String *input = block;
+    if (block->length > FRAME_TRIAL_CHUNKS * FRAME_TRIAL_CHUNK_SIZE) {
+        String *sample = string_arena_new(ctx->scratch, FRAME_TRIAL_CHUNKS * FRAME_TRIAL_CHUNK_SIZE + 1);
+        if (!sample) {
+            error = true;
+            goto cleanup;
+        }
+        size_t stride = (block->length - FRAME_TRIAL_CHUNK_SIZE) / (FRAME_TRIAL_CHUNKS - 1);
+        for (size_t chunk = 0; chunk < FRAME_TRIAL_CHUNKS; ++chunk) {
+            memcpy(sample->data + sample->length, block->data + stride * chunk, FRAME_TRIAL_CHUNK_SIZE);
+            sample->length += FRAME_TRIAL_CHUNK_SIZE;
+        }
+        sample->data[sample->length] = '\0';
+        input = sample;
+    }
+    trial = string_new();
+    if (!trial) {
+        error = true;
+        goto cleanup;
+    }
+
+    lz_context_set_stats(ctx, NULL);
+    size_t best_length = SIZE_MAX;
+    for (Algo algo = 0; algo < ALGO_CODEC_COUNT; ++algo) {
+        trial->length = 0;
+        if (lz_compress(ctx, algo, input, trial) < 0) {
+            error = true;
+            goto cleanup;
+        }
+        if (trial->length < best_length) {
+            best_length = trial->length;
+            best = algo;
+            if (input == block && !stats) {
+                String swap = *payload;
+                *payload = *trial;
+                *trial = swap;
+            }
+        }
+    }
+
+cleanup:
+    lz_context_set_stats(ctx, stats);
+    if (trial) {
+        string_free(trial);
+    }
+    return error ? -1 : best;
+}
+
+// For FILTER_AUTO: compresses a contiguous sample from the middle of the block after every
+// filter and returns the filter with the smallest output. With ALGO_AUTO the trials use LZ77.
+int frame_filter_choose(LZ_Context *ctx, const String *block) {
+    bool error = false;
+    String *trial = NULL;
+    Stats *stats = ctx->stats;
+    int best = FILTER_NONE;
+
+    size_t length = block->length < FRAME_FILTER_TRIAL_SIZE ? block->length : FRAME_FILTER_TRIAL_SIZE;
+    // Keeps the sample aligned for filters on 8-byte elements.
+    size_t start = (block->length - length) / 2 / 8 * 8;
+    String *filtered = string_arena_new(ctx->scratch, length + 1);
+    trial = string_new();
+    if (!filtered || !trial) {
+        error = true;
+        goto cleanup;
+    }
+    Algo algo = ctx->algo == ALGO_AUTO ? ALGO_LZ77 : ctx->algo;
+
+    lz_context_set_stats(ctx, NULL);
+    size_t best_length = SIZE_MAX;
+    for (Filter filter = 0; filter < FILTER_COUNT; ++filter) {
+        filter_encode(filter, block->data + start, filtered->data, length);
+        filtered->length = length;
+        filtered->data[length] = '\0';
+        trial->length = 0;
+        if (lz_compress(ctx, algo, filtered, trial) < 0) {
+            error = true;
+            goto cleanup;
+        }
+        if (trial->length < best_length) {
+            best_length = trial->length;
+            best = filter;
+        }
+    }
+
+cleanup:
+    lz_context_set_stats(ctx, stats);
+    if (trial) {
+        string_free(trial);
+    }
+    return error ? -1 : best;
+}
+
+// --target-speed: after a block that took `seconds`, steps the LZ77 level down if it fell
+// short of the target, or up if it beat the target with room to spare and the next level was
+// not last seen too slow. Each block is timed on its own, so a new level is judged at once.
+void frame_tune(LZ_Context *ctx, size_t length, double seconds) {
+    int level = ctx->level;
+    double speed = seconds > 0 ? length / seconds : ctx->target_speed * FRAME_TUNE_HEADROOM;
+    ctx->level_speeds[level] = speed;
+    if (speed < ctx->target_speed) {
+        if (level > LZ77_LEVEL_MIN) {
+            lz_context_set_level(ctx, level - 1);
+        }
+        return;
+    }
+    if (level == ctx->max_level) {
+        return;
+    }
+    double *next = &ctx->level_speeds[level + 1];
+    *next *= FRAME_TUNE_RETRY;
+    if (speed >= ctx->target_speed * FRAME_TUNE_HEADROOM && (*next == 0 || *next >= ctx->target_speed)) {
+        lz_context_set_level(ctx, level + 1);
+    }
+}
+
+int frame_block_write(LZ_Context *ctx, const FrameHeader *frame, const String *block, uint64_t start, void *writer, size_t *written) {
+    bool error = false;
+    String *payload = NULL;
+    int algo = ctx->algo;
+    int filter = ctx->filter;
+    uint8_t type;
+
+    mem_arena_reset(ctx->scratch);
+    double started = ctx->target_speed > 0 ? stats_wall_clock() : 0;
+    int level = ctx->level;
+    stats_begin(ctx->stats, STATS_COMPRESS);
+    payload = string_new();
+    if (!payload) {
+        error = true;
+        goto cleanup;
+    }
+    if (filter == FILTER_AUTO) {
+        filter = frame_filter_choose(ctx, block);
+        if (filter < 0) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    const String *input = block;
+    if (filter != FILTER_NONE) {
+        String *filtered = string_arena_new(ctx->scratch, block->length + 1);
+        if (!filtered) {
+            error = true;
+            goto cleanup;
+        }
+        filter_encode(filter, block->data, filtered->data, block->length);
+        filtered->length = block->length;
+        filtered->data[filtered->length] = '\0';
+        input = filtered;
+    }
+    if (frame_block_incompressible(input)) {
+        type = FRAME_BLOCK_STORED;
+    } else {
+        if (algo == ALGO_AUTO) {
+            algo = frame_block_choose(ctx, input, payload);
+            if (algo < 0) {
+                error = true;
+                goto cleanup;
+            }
+        }
+        type = algo | filter << FRAME_BLOCK_FILTER_SHIFT;
+        // Empty unless the choice already produced the encoding.
+        if (payload->length == 0 && lz_compress(ctx, algo, input, payload) < 0) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    if (type != FRAME_BLOCK_STORED && payload->length >= block->length) {
+        // Whatever the estimate said, a block never grows by more than its header.
+        type = FRAME_BLOCK_STORED;
+    }
+    stats_end(ctx->stats, STATS_COMPRESS);
+    // Stored blocks say nothing about the codec's speed, and tiny ones are mostly noise.
+    if (ctx->target_speed > 0 && type != FRAME_BLOCK_STORED && block->length >= FRAME_MIN_BLOCK_SIZE) {
+        frame_tune(ctx, block->length, stats_wall_clock() - started);
+        if (ctx->stats) {
+            ctx->stats->target_speed = ctx->target_speed;
+            ctx->stats->level_blocks[level] += 1;
+            ctx->stats->last_level = ctx->level;
+        }
+    }
+    if (ctx->debug) {
+        if (type == FRAME_BLOCK_STORED) {
+            fprintf(ctx->debug, "stored block (%zu bytes)\n", block->length);
+        } else {
+            if (ctx->algo == ALGO_AUTO) {
+                fprintf(ctx->debug, "%s block (%zu bytes)\n", lz_algo_name(algo), block->length);
+            }
+            if (filter != FILTER_NONE) {
+                fprintf(ctx->debug, "%s filter\n", filter_name(filter));
+            }
+            if (frame_debug_print(ctx, algo, payload->data, payload->length) < 0) {
+                error = true;
+                goto cleanup;
+            }
+        }
+    }
+    const uint8_t *data = type == FRAME_BLOCK_STORED ? block->data : payload->data;
+    size_t length = type == FRAME_BLOCK_STORED ? block->length : payload->length;
+    if (length > UINT32_MAX) {
+        error = true;
+        goto cleanup;
+    }
+    if (ctx->stats && type == FRAME_BLOCK_STORED) {
+        ctx->stats->stored_blocks += 1;
+    }
+    BlockHeader encoded = {.type = type, .uncompressed_size = block->length, .compressed_size = length};
+    if (frame->flags & FRAME_FLAG_CHECKSUM) {
+        encoded.payload_checksum = checksum32(data, length);
+        encoded.content_checksum = checksum64(block->data, block->length);
+    }
+    // A stored block holds its input as is; there is nothing to check.
+    if (ctx->verifier && type != FRAME_BLOCK_STORED) {
+        if (verify_submit(ctx->verifier, &encoded, start, block->data, data) < 0) {
+            error = true;
+            goto cleanup;
+        }
+    }
+
+    stats_begin(ctx->stats, STATS_WRITE);
+    uint8_t header[BLOCK_HEADER_SIZE + BLOCK_CHECKSUM_SIZE];
+    size_t header_length = frame_block_header_write_buf(frame, &encoded, header);
+    if (aio_writer_write(writer, header, header_length) < 0 || aio_writer_write(writer, data, length) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+    *written = header_length + length;
+
+cleanup:
+    if (payload) {
+        string_free(payload);
+    }
+    return error ? -1 : 0;
+}
+
+// `content` is the input the copy stands for, which only its checksum needs.
+int frame_copy_write(LZ_Context *ctx, const FrameHeader *frame, const DedupMatch *match, const uint8_t *content, void *writer, size_t *written) {
+    uint8_t payload[FRAME_COPY_PAYLOAD_SIZE];
+    uint64_be_write(payload, match->source);
+    BlockHeader block = {.type = FRAME_BLOCK_COPY, .uncompressed_size = match->length, .compressed_size = FRAME_COPY_PAYLOAD_SIZE};
+    if (frame->flags & FRAME_FLAG_CHECKSUM) {
+        block.payload_checksum = checksum32(payload, sizeof(payload));
+        block.content_checksum = checksum64(content, match->length);
+    }
+    uint8_t buf[BLOCK_HEADER_SIZE + BLOCK_CHECKSUM_SIZE + FRAME_COPY_PAYLOAD_SIZE];
+    size_t length = frame_block_header_write_buf(frame, &block, buf);
+    memcpy(buf + length, payload, sizeof(payload));
+    length += sizeof(payload);
+    if (ctx->debug) {
+        fprintf(ctx->debug, "copy block (%u bytes from %llu)\n", match->length, (unsigned long long)match->source);
+    }
+    if (ctx->stats) {
+        ctx->stats->long_matches += 1;
+        ctx->stats->long_match_bytes += match->length;
+    }
+    stats_begin(ctx->stats, STATS_WRITE);
+    if (aio_writer_write(writer, buf, length) < 0) {
+        return -1;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+    *written = length;
+    return 0;
+}
+
+// Writes one block and records it in the index, if there is one.
+int frame_compress_block(LZ_Context *ctx, const FrameHeader *header, FrameIndex *index, const String *block, uint64_t start, void *writer) {
+    if (index->enabled) {
+        if (index->length == index->capacity) {
+            size_t capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+            FrameIndexEntry *grown = mem_realloc(index->entries, sizeof(FrameIndexEntry) * capacity);
+            if (!grown) {
+                return -1;
+            }
+            index->entries = grown;
+            index->capacity = capacity;
+        }
+        index->entries[index->length++] = (FrameIndexEntry){.uncompressed_offset = start, .compressed_offset = index->offset};
+    }
+    size_t written;
+    if (frame_block_write(ctx, header, block, start, writer, &written) < 0) {
+        return -1;
+    }
+    index->offset += written;
+    return 0;
+}
+
+// With FRAME_FLAG_LONG the whole input is needed up front to find long matches, and the input
+// between them is cut into blocks. Otherwise blocks are compressed as they are read, with the
+// next one being read and the previous one written meanwhile.
+int frame_compress_long(LZ_Context *ctx, const FrameHeader *header, FrameIndex *index, FILE *input, void *writer) {
+    bool error = false;
+    String *data = NULL;
+    DedupMatch *matches = NULL;
+    size_t match_count = 0;
+
+    stats_begin(ctx->stats, STATS_READ);
+    data = string_from_stream(input);
+    stats_end(ctx->stats, STATS_READ);
+    if (!data) {
+        error = true;
+        goto cleanup;
+    }
+    if (ctx->stats) {
+        ctx->stats->input_bytes += data->length;
+    }
+    stats_begin(ctx->stats, STATS_COMPRESS);
+    if (dedup_find(data, &matches, &match_count) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_end(ctx->stats, STATS_COMPRESS);
+
+    size_t start = 0;
+    for (size_t m = 0; m <= match_count; ++m) {
+        size_t end = m < match_count ? matches[m].start : data->length;
+        while (start < end) {
+            size_t length = end - start < header->block_size ? end - start : header->block_size;
+            // A borrowed view into the input; codecs only read from it.
+            const String block = string_view(data->data + start, length);
+            if (frame_compress_block(ctx, header, index, &block, start, writer) < 0) {
+                error = true;
+                goto cleanup;
+            }
+            start += length;
+        }
+        if (m < match_count) {
+            size_t written;
+            if (frame_copy_write(ctx, header, &matches[m], data->data + matches[m].start, writer, &written) < 0) {
+                error = true;
+                goto cleanup;
+            }
+            index->offset += written;
+            start += matches[m].length;
+        }
+    }
+
+cleanup:
+    if (data) {
+        string_free(data);
+    }
+    mem_free(matches);
+    return error ? -1 : 0;
+}
+
+int frame_compress_stream(LZ_Context *ctx, const FrameHeader *header, FrameIndex *index, void *reader, void *writer) {
+    int result = 0;
+    uint64_t start = 0;
+    while (true) {
+        stats_begin(ctx->stats, STATS_READ);
+        const String *block = aio_reader_next(reader);
+        stats_end(ctx->stats, STATS_READ);
+        if (!block) {
+            result = -1;
+            break;
+        }
+        if (block->length == 0) {
+            break;
+        }
+        if (ctx->stats) {
+            ctx->stats->input_bytes += block->length;
+        }
+        if (frame_compress_block(ctx, header, index, block, start, writer) < 0) {
+            result = -1;
+            break;
+        }
+        start += block->length;
+    }
+    return result;
+}
+
+// frame_compress() through a reader of header->block_size bytes and a writer the caller
+// keeps from one frame to the next, both attached to the streams already. --long reads
+// `input` whole, and needs no reader.
+int frame_compress_io(LZ_Context *ctx, const FrameHeader *header, FILE *input, void *reader, void *writer) {
+    bool error = false;
+    FrameIndex index = {.enabled = header->flags & FRAME_FLAG_SEEKABLE};
+
+    // Copy blocks depend on earlier output, so they cannot be combined with random access.
+    if ((header->flags & FRAME_FLAG_LONG) && (header->flags & FRAME_FLAG_SEEKABLE)) {
+        error = true;
+        goto cleanup;
+    }
+
+    uint8_t buf[FRAME_HEADER_MAX_SIZE];
+    size_t header_length = frame_header_write_buf(header, buf);
+    if (aio_writer_write(writer, buf, header_length) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    index.offset = header_length;
+    if (ctx->verifier) {
+        verify_begin(ctx->verifier, header);
+    }
+
+    int result = header->flags & FRAME_FLAG_LONG ? frame_compress_long(ctx, header, &index, input, writer)
+                                                  : frame_compress_stream(ctx, header, &index, reader, writer);
+    // Without its end marker, the output of a failed verification cannot pass for complete.
+    if (ctx->verifier && verify_finish(ctx->verifier) < 0) {
+        result = -1;
+    }
+    if (result < 0) {
+        error = true;
+        goto cleanup;
+    }
+
+    uint8_be_write(buf, FRAME_BLOCK_END);
+    if (aio_writer_write(writer, buf, 1) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    index.offset += 1;
+
+    if (index.enabled) {
+        for (size_t i = 0; i < index.length; ++i) {
+            uint8_t entry[FRAME_INDEX_ENTRY_SIZE];
+            uint64_be_write(entry, index.entries[i].uncompressed_offset);
+            uint64_be_write(entry + 8, index.entries[i].compressed_offset);
+            if (aio_writer_write(writer, entry, sizeof(entry)) < 0) {
+                error = true;
+                goto cleanup;
+            }
+        }
+        uint8_t trailer[FRAME_INDEX_TRAILER_SIZE];
+        uint32_be_write(trailer, index.length);
+        memcpy(trailer + 4, FRAME_INDEX_MAGIC, FRAME_INDEX_MAGIC_SIZE);
+        if (aio_writer_write(writer, trailer, sizeof(trailer)) < 0) {
+            error = true;
+            goto cleanup;
+        }
+        index.offset += index.length * FRAME_INDEX_ENTRY_SIZE + sizeof(trailer);
+    }
+    stats_begin(ctx->stats, STATS_WRITE);
+    if (aio_writer_finish(writer) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+    if (ctx->stats) {
+        ctx->stats->output_bytes += index.offset;
+    }
+
+cleanup:
+    mem_free(index.entries);
+    return error ? -1 : 0;
+}
+
+// Both streams are used through their file descriptors, so nothing may have been read from
+// `input` or be left buffered for `output` through stdio.
+int frame_compress(LZ_Context *ctx, const FrameHeader *header, FILE *input, FILE *output) {
+    bool error = false;
+    void *reader = NULL;
+    void *writer = NULL;
+
+    writer = aio_writer_new(output, frame_write_size(header));
+    if (!writer) {
+        error = true;
+        goto cleanup;
+    }
+    if (!(header->flags & FRAME_FLAG_LONG)) {
+        reader = aio_reader_new(input, header->block_size);
+        if (!reader) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    if (frame_compress_io(ctx, header, input, reader, writer) < 0) {
+        error = true;
+        goto cleanup;
+    }
+
+cleanup:
+    if (reader) {
+        aio_reader_free(reader);
+    }
+    if (writer) {
+        aio_writer_free(writer);
+    }
+    return error ? -1 : 0;
+}
+
+// Stored payloads are read straight into the output buffer.
+String *frame_block_read_stored(LZ_Context *ctx, const FrameHeader *header, const BlockHeader *block, FILE *input) {
+    if (block->compressed_size != block->uncompressed_size) {
+        return NULL;
+    }
+    String *buf = string_with_capacity(block->uncompressed_size + 1);
+    if (!buf) {
+        return NULL;
+    }
+    stats_begin(ctx->stats, STATS_READ);
+    buf->length = fread(buf->data, 1, block->compressed_size, input);
+    stats_end(ctx->stats, STATS_READ);
+    if (buf->length != block->compressed_size ||
+        ((header->flags & FRAME_FLAG_CHECKSUM) && checksum32(buf->data, buf->length) != block->payload_checksum)) {
+        string_free(buf);
+        return NULL;
+    }
+    buf->data[buf->length] = '\0';
+    if (ctx->stats) {
+        ctx->stats->input_bytes += frame_block_header_size(header) + block->compressed_size;
+        ctx->stats->stored_blocks += 1;
+    }
+    if (ctx->debug) {
+        fprintf(ctx->debug, "stored block (%zu bytes)\n", buf->length);
+    }
+    return buf;
+}
+
+// Decodes the payload of a codec block, which must have passed frame_block_decode()'s size
+// checks; `header` is the frame's. Also used by the verifier on freshly encoded blocks.
+String *frame_block_decode_payload(LZ_Context *ctx, const FrameHeader *header, const BlockHeader *block, const uint8_t *payload) {
+    bool error = false;
+    String *buf = NULL;
+    String *unfiltered = NULL;
+
+    Algo algo = block->type & FRAME_BLOCK_ALGO_MASK;
+    Filter filter = block->type >> FRAME_BLOCK_FILTER_SHIFT;
+    bool auto_type = ctx->algo == ALGO_AUTO && algo < ALGO_CODEC_COUNT;
+    if ((algo != ctx->algo && !auto_type) || filter >= FILTER_COUNT || block->uncompressed_size > header->block_size) {
+        error = true;
+        goto cleanup;
+    }
+
+    if (ctx->debug && ctx->algo == ALGO_AUTO) {
+        fprintf(ctx->debug, "%s block (%u bytes)\n", lz_algo_name(algo), block->uncompressed_size);
+    }
+    if (ctx->debug && filter != FILTER_NONE) {
+        fprintf(ctx->debug, "%s filter\n", filter_name(filter));
+    }
+    if (ctx->debug && frame_debug_print(ctx, algo, payload, block->compressed_size) < 0) {
+        error = true;
+        goto cleanup;
+    }
+
+    stats_begin(ctx->stats, STATS_DECOMPRESS);
+    buf = string_with_capacity(block->uncompressed_size + 1);
+    if (!buf) {
+        error = true;
+        goto cleanup;
+    }
+    if (lz_decode(ctx, algo, payload, block->compressed_size, buf) < 0 || buf->length != block->uncompressed_size) {
+        error = true;
+        goto cleanup;
+    }
+    if (filter != FILTER_NONE) {
+        unfiltered = string_with_capacity(buf->length + 1);
+        if (!unfiltered) {
+            error = true;
+            goto cleanup;
+        }
+        filter_decode(filter, buf->data, unfiltered->data, buf->length);
+        unfiltered->length = buf->length;
+        unfiltered->data[unfiltered->length] = '\0';
+        string_free(buf);
+        buf = unfiltered;
+        unfiltered = NULL;
+    }
+    stats_end(ctx->stats, STATS_DECOMPRESS);
+
+cleanup:
+    if (unfiltered) {
+        string_free(unfiltered);
+    }
+    if (error) {
+        if (buf) {
+            string_free(buf);
+        }
+        return NULL;
+    }
+    return buf;
+}
+
+String *frame_block_decode(LZ_Context *ctx, const FrameHeader *header, const BlockHeader *block, FILE *input) {
+    // frame_memory_needed() sized the budget by the declared block size.
+    if (block->compressed_size == 0 || block->compressed_size > block->uncompressed_size ||
+        block->uncompressed_size > header->block_size) {
+        return NULL;
+    }
+    if (block->type == FRAME_BLOCK_STORED) {
+        return frame_block_read_stored(ctx, header, block, input);
+    }
+
+    mem_arena_reset(ctx->scratch);
+    stats_begin(ctx->stats, STATS_READ);
+    uint8_t *payload = mem_arena_alloc(ctx->scratch, block->compressed_size);
+    if (!payload || fread(payload, 1, block->compressed_size, input) != block->compressed_size) {
+        return NULL;
+    }
+    stats_end(ctx->stats, STATS_READ);
+    if (ctx->stats) {
+        ctx->stats->input_bytes += frame_block_header_size(header) + block->compressed_size;
+    }
+    // A corrupted payload never reaches the decoder.
+    if ((header->flags & FRAME_FLAG_CHECKSUM) && checksum32(payload, block->compressed_size) != block->payload_checksum) {
+        return NULL;
+    }
+    return frame_block_decode_payload(ctx, header, block, payload);
+}
+
+// Without a writer (--test) the output is only counted.
+int frame_write_output(LZ_Context *ctx, const uint8_t *data, size_t length, void *writer) {
+    stats_begin(ctx->stats, STATS_WRITE);
+    if (writer && aio_writer_write(writer, data, length) < 0) {
+        return -1;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+    if (ctx->stats) {
+        ctx->stats->output_bytes += length;
+    }
+    return 0;
+}
+
+// Repeats earlier output for a copy block. The source may overlap the bytes being produced,
+// in which case they are copied one at a time like an LZ77 match.
+int frame_copy_read(LZ_Context *ctx, const FrameHeader *header, const BlockHeader *block, FILE *input, String *history) {
+    uint8_t buf[FRAME_COPY_PAYLOAD_SIZE];
+    if (block->compressed_size != FRAME_COPY_PAYLOAD_SIZE || fread(buf, 1, sizeof(buf), input) != sizeof(buf)) {
+        return -1;
+    }
+    bool checksum = header->flags & FRAME_FLAG_CHECKSUM;
+    if (checksum && checksum32(buf, sizeof(buf)) != block->payload_checksum) {
+        return -1;
+    }
+    uint64_t source = uint64_be_read(buf);
+    size_t length = block->uncompressed_size;
+    if (source >= history->length || string_grow(history, length) < 0) {
+        return -1;
+    }
+    uint8_t *dst = history->data + history->length;
+    const uint8_t *src = history->data + source;
+    if (src + length <= dst) {
+        memcpy(dst, src, length);
+    } else {
+        for (size_t i = 0; i < length; ++i) {
+            dst[i] = src[i];
+        }
+    }
+    // Copies are rare and the history is kept anyway, so they are checked right here.
+    if (checksum && checksum64(dst, length) != block->content_checksum) {
+        return -1;
+    }
+    history->length += length;
+    history->data[history->length] = '\0';
+    if (ctx->stats) {
+        ctx->stats->input_bytes += frame_block_header_size(header) + FRAME_COPY_PAYLOAD_SIZE;
+        ctx->stats->long_matches += 1;
+        ctx->stats->long_match_bytes += length;
+    }
+    if (ctx->debug) {
+        fprintf(ctx->debug, "copy block (%zu bytes from %llu)\n", length, (unsigned long long)source);
+    }
+    return 0;
+}
+
+// frame_decompress() through a writer the caller keeps from one frame to the next, attached
+// to the output already, or NULL to only decode and check.
+int frame_decompress_io(LZ_Context *ctx, const FrameHeader *header, FILE *input, void *writer) {
+    bool error = false;
+    String *history = NULL;
+    void *checker = NULL;
+
+    if (header->flags & FRAME_FLAG_CHECKSUM) {
+        checker = checksum_checker_new();
+        if (!checker) {
+            error = true;
+            goto cleanup;
+        }
+    }
+
+    if (header->flags & FRAME_FLAG_LONG) {
+        history = string_new();
+        if (!history) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    while (true) {
+        BlockHeader block;
+        int status = frame_block_header_read(header, &block, input);
+        if (status < 0) {
+            error = true;
+            goto cleanup;
+        }
+        if (status > 0) {
+            break;
+        }
+        if (block.type == FRAME_BLOCK_COPY) {
+            size_t from = history ? history->length : 0;
+            if (!history || frame_copy_read(ctx, header, &block, input, history) < 0 ||
+                frame_write_output(ctx, history->data + from, history->length - from, writer) < 0) {
+                error = true;
+                goto cleanup;
+            }
+            continue;
+        }
+        String *buf = frame_block_decode(ctx, header, &block, input);
+        if (!buf) {
+            error = true;
+            goto cleanup;
+        }
+        if (writer && !history && !checker) {
+            size_t length = buf->length;
+            stats_begin(ctx->stats, STATS_WRITE);
+            if (aio_writer_give(writer, buf) < 0) {
+                error = true;
+                goto cleanup;
+            }
+            stats_end(ctx->stats, STATS_WRITE);
+            if (ctx->stats) {
+                ctx->stats->output_bytes += length;
+            }
+            continue;
+        }
+        int written = frame_write_output(ctx, buf->data, buf->length, writer);
+        if (written == 0 && history) {
+            if (string_append(history, buf->data, buf->length) < 0) {
+                written = -1;
+            }
+        }
+        if (written < 0) {
+            string_free(buf);
+            error = true;
+            goto cleanup;
+        }
+        if (checker) {
+            // The output already holds a copy, so the checker can keep `buf` until it is done.
+            if (checksum_checker_submit(checker, buf, block.content_checksum) < 0) {
+                error = true;
+                goto cleanup;
+            }
+        } else {
+            string_free(buf);
+        }
+    }
+    if (checker && checksum_checker_finish(checker) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_begin(ctx->stats, STATS_WRITE);
+    if (writer && aio_writer_finish(writer) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+
+cleanup:
+    checksum_checker_free(checker);
+    if (history) {
+        string_free(history);
+    }
+    return error ? -1 : 0;
+}
+
+// Decodes the blocks following an already read frame header. Nothing here seeks, so the
+// input may be a pipe. Output is written through its file descriptor while the next block
+// is decoded; decoded blocks are handed to the writer as they are rather than copied into its
+// buffer, unless they are still needed here. With FRAME_FLAG_LONG all output is kept in
+// `history` for copy blocks to refer back to, just as compression holds all of the input.
+// With FRAME_FLAG_CHECKSUM, payloads are checked before they are decoded, and decoded blocks
+// are handed to a checker thread that hashes one while the next is decoded. A NULL `output`
+// only decodes and checks (--test).
+int frame_decompress(LZ_Context *ctx, const FrameHeader *header, FILE *input, FILE *output) {
+    void *writer = NULL;
+    if (output) {
+        writer = aio_writer_new(output, frame_write_size(header));
+        if (!writer) {
+            return -1;
+        }
+    }
+    int result = frame_decompress_io(ctx, header, input, writer);
+    if (writer) {
+        aio_writer_free(writer);
+    }
+    return result;
+}
+
+// Decodes only the blocks overlapping [start, start + length), found through the index at
+// the end of a seekable frame.
+int frame_decompress_range(LZ_Context *ctx, const FrameHeader *header, FILE *input, uint64_t start, uint64_t length, FILE *output) {
+    bool error = false;
+    FrameIndexEntry *index = NULL;
+    void *writer = NULL;
+
+    writer = aio_writer_new(output, frame_write_size(header));
+    if (!writer) {
+        error = true;
+        goto cleanup;
+    }
+
+    uint8_t trailer[FRAME_INDEX_TRAILER_SIZE];
+    if (fseek(input, -FRAME_INDEX_TRAILER_SIZE, SEEK_END) != 0 ||
+        fread(trailer, 1, sizeof(trailer), input) != sizeof(trailer) ||
+        memcmp(trailer + 4, FRAME_INDEX_MAGIC, FRAME_INDEX_MAGIC_SIZE) != 0) {
+        error = true;
+        goto cleanup;
+    }
+    // An empty input has an empty index: nothing below is decoded, but the output still goes
+    // through aio_writer_finish() like any other.
+    size_t index_length = uint32_be_read(trailer);
+    if (index_length > 0) {
+        index = mem_alloc(sizeof(FrameIndexEntry) * index_length);
+        if (!index) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    long index_offset = -(long)(FRAME_INDEX_TRAILER_SIZE + index_length * FRAME_INDEX_ENTRY_SIZE);
+    if (fseek(input, index_offset, SEEK_END) != 0) {
+        error = true;
+        goto cleanup;
+    }
+    for (size_t i = 0; i < index_length; ++i) {
+        uint8_t entry[FRAME_INDEX_ENTRY_SIZE];
+        if (fread(entry, 1, sizeof(entry), input) != sizeof(entry)) {
+            error = true;
+            goto cleanup;
+        }
+        index[i].uncompressed_offset = uint64_be_read(entry);
+        index[i].compressed_offset = uint64_be_read(entry + 8);
+    }
+
+    size_t first = 0;
+    size_t last = index_length;
+    while (last - first > 1) {
+        size_t middle = first + (last - first) / 2;
+        if (index[middle].uncompressed_offset <= start) {
+            first = middle;
+        } else {
+            last = middle;
+        }
+    }
+
+    uint64_t end = length > UINT64_MAX - start ? UINT64_MAX : start + length;
+    for (size_t i = first; i < index_length && index[i].uncompressed_offset < end; ++i) {
+        BlockHeader block;
+        if (fseek(input, index[i].compressed_offset, SEEK_SET) != 0 ||
+            frame_block_header_read(header, &block, input) != 0) {
+            error = true;
+            goto cleanup;
+        }
+        String *buf = frame_block_decode(ctx, header, &block, input);
+        if (!buf) {
+            error = true;
+            goto cleanup;
+        }
+        if ((header->flags & FRAME_FLAG_CHECKSUM) && checksum64(buf->data, buf->length) != block.content_checksum) {
+            string_free(buf);
+            error = true;
+            goto cleanup;
+        }
+        uint64_t block_start = index[i].uncompressed_offset;
+        uint64_t from = start > block_start ? start - block_start : 0;
+        uint64_t to = end - block_start < buf->length ? end - block_start : buf->length;
+        int written = from < to ? frame_write_output(ctx, buf->data + from, to - from, writer) : 0;
+        string_free(buf);
+        if (written < 0) {
+            error = true;
+            goto cleanup;
+        }
+    }
+    stats_begin(ctx->stats, STATS_WRITE);
+    if (aio_writer_finish(writer) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    stats_end(ctx->stats, STATS_WRITE);
+
+cleanup:
+    if (writer) {
+        aio_writer_free(writer);
+    }
+    mem_free(index);
+    return error ? -1 : 0;
+}
@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lz.h"
+#include "string.h"
+
+#define FRAME_MAGIC "LZF\x02"
+#define FRAME_MAGIC_SIZE 4
+#define FRAME_FLAG_DICT (1 << 0)
+#define FRAME_FLAG_SEEKABLE (1 << 1)
+#define FRAME_FLAG_LONG (1 << 2)
+#define FRAME_FLAG_CHECKSUM (1 << 3)
+#define FRAME_DEFAULT_BLOCK_SIZE (1 << 20)
+#define FRAME_BLOCK_FILTER_SHIFT 4
+#define FRAME_BLOCK_ALGO_MASK 0x0F
+#define FRAME_BLOCK_COPY 0xFD
+#define FRAME_BLOCK_STORED 0xFE
+#define FRAME_BLOCK_END 0xFF
+#define FRAME_INDEX_MAGIC "LZIX"
+#define FRAME_INDEX_MAGIC_SIZE 4
+
+typedef struct {
+    Algo algo;
+    uint8_t flags;
+    uint32_t dict_id;
+    uint32_t block_size;
+} FrameHeader;
+
+typedef struct {
+    uint8_t type;
+    uint32_t uncompressed_size;
+    uint32_t compressed_size;
+    // Only with FRAME_FLAG_CHECKSUM: checksum32() of the payload, checksum64() of the data.
+    uint32_t payload_checksum;
+    uint64_t content_checksum;
+} BlockHeader;
+
+typedef struct {
+    uint64_t uncompressed_offset;
+    uint64_t compressed_offset;
+} FrameIndexEntry;
+
+// What frame_memory_needed() estimates for.
+typedef enum {
+    FRAME_MEMORY_DECOMPRESS,
+    FRAME_MEMORY_COMPRESS,
+    // Compressing with --verify: a second context and the verifier's buffers on top.
+    FRAME_MEMORY_VERIFY,
+} FrameMemory;
+
+int frame_header_write(const FrameHeader *header, FILE *stream);
+
+int frame_header_read(FrameHeader *header, FILE *stream);
+
+size_t frame_write_size(const FrameHeader *header);
+
+size_t frame_memory_needed(const FrameHeader *header, FrameMemory use, int level);
+
+uint32_t frame_block_size_for(const FrameHeader *header, FrameMemory use, int level, size_t budget);
+
+size_t frame_decompress_memory_needed(const FrameHeader *header, FILE *input);
+
+int frame_compress_io(LZ_Context *ctx, const FrameHeader *header, FILE *input, void *reader, void *writer);
+
+int frame_compress(LZ_Context *ctx, const FrameHeader *header, FILE *input, FILE *output);
+
+String *frame_block_decode_payload(LZ_Context *ctx, const FrameHeader *header, const BlockHeader *block, const uint8_t *payload);
+
+int frame_decompress_io(LZ_Context *ctx, const FrameHeader *header, FILE *input, void *writer);
+
+int frame_decompress(LZ_Context *ctx, const FrameHeader *header, FILE *input, FILE *output);
+
+int frame_decompress_range(LZ_Context *ctx, const FrameHeader *header, FILE *input, uint64_t start, uint64_t length, FILE *output);
+
+#endif // FRAME_H
@@ -1,6 +1,8 @@
 /* SPDX-License-Identifier: MIT */
 /* Copyright (c) 2025 Saleh Zaidan */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -8,17 +10,22 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
+#include "frame.h"
 #include "lz.h"
+#include "mem.h"
 #include "string.h"
+#include "verify.h"
 
 #define DEBUG_COMPRESSED_REPR (1 << 0)
 
-const char *escape_char(char ch) {
-    static char escape_char_buf[2];
+// Writes into `buf` (ESCAPE_CHAR_BUF_SIZE bytes) rather than a static buffer so that
+// codecs can print from several threads at once.
+const char *escape_char(char ch, char *buf) {
     if (isprint(ch)) {
-        escape_char_buf[0] = ch;
-        escape_char_buf[1] = '\0';
-        return escape_char_buf;
+        buf[0] = ch;
+        buf[1] = '\0';
+        return buf;
     }
     switch (ch) {
     case '\n': return "\\n";
@@ -32,7 +39,8 @@ const char *escape_char(char ch) {
     case '\"': return "\\\"";
     case '\0': return "\\0";
     }
-    return NULL;
+    snprintf(buf, ESCAPE_CHAR_BUF_SIZE, "\\x%02X", (uint8_t)ch);
+    return buf;
 }
 
 void uint8_be_write(uint8_t *buf, uint8_t value) {
@@ -44,28 +52,32 @@ void uint16_be_write(uint8_t *buf, uint16_t value) {
     buf[1] = value & 0xFF;
 }
 
-uint8_t uint8_be_read(uint8_t *buf) {
+void uint32_be_write(uint8_t *buf, uint32_t value) {
+    buf[0] = (value >> 24) & 0xFF;
+    buf[1] = (value >> 16) & 0xFF;
+    buf[2] = (value >> 8) & 0xFF;
+    buf[3] = value & 0xFF;
+}
+
+void uint64_be_write(uint8_t *buf, uint64_t value) {
+    uint32_be_write(buf, value >> 32);
+    uint32_be_write(buf + 4, value & 0xFFFFFFFF);
+}
+
+uint8_t uint8_be_read(const uint8_t *buf) {
     return buf[0];
 }
 
-uint16_t uint16_be_read(uint8_t *buf) {
+uint16_t uint16_be_read(const uint8_t *buf) {
     return buf[0] << 8 | buf[1];
 }
 
-int lz_serialize(Algo algo, const void *compressed, FILE *stream) {
-    int (*fn)(const void *, FILE *);
-    switch (algo) {
-    case ALGO_LZ77:
-        fn = lz77_serialize;
-        break;
-    case ALGO_LZ78:
-        fn = lz78_serialize;
-        break;
-    case ALGO_LZW:
-        fn = lzw_serialize;
-        break;
-    }
-    return fn(compressed, stream);
+uint32_t uint32_be_read(const uint8_t *buf) {
+    return (uint32_t)buf[0] << 24 | (uint32_t)buf[1] << 16 | (uint32_t)buf[2] << 8 | buf[3];
+}
+
+uint64_t uint64_be_read(const uint8_t *buf) {
+    return (uint64_t)uint32_be_read(buf) << 32 | uint32_be_read(buf + 4);
 }
 
 void *lz_deserialize(Algo algo, FILE *stream) {
@@ -76,49 +88,285 @@ void *lz_deserialize(Algo algo, FILE *stream) {
         return lz78_deserialize(stream);
     case ALGO_LZW:
         return lzw_deserialize(stream);
+    case ALGO_LZAP:
+        return lzap_deserialize(stream);
+    default:
+        break;
     }
     return NULL;
 }
 
-void *lz_compress(Algo algo, const String *input) {
+// The number of leading bytes equal to data[0], compared a word at a time.
+size_t byte_run_length(const uint8_t *data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    uint64_t pattern = data[0] * 0x0101010101010101ull;
+    size_t run = 1;
+    while (run + 8 <= length) {
+        uint64_t word;
+        memcpy(&word, data + run, sizeof(word));
+        if (word != pattern) {
+            break;
+        }
+        run += 8;
+    }
+    while (run < length && data[run] == data[0]) {
+        run += 1;
+    }
+    return run;
+}
+
+// Decoding never searches for matches, so a context that only decodes can be limited to
+// LZ77_LEVEL_MIN, the smallest tables.
+LZ_Context *lz_context_new(Algo algo, int max_level) {
+    LZ_Context *ctx = mem_alloc(sizeof(LZ_Context));
+    if (!ctx) {
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(LZ_Context));
+    ctx->algo = algo;
+    ctx->max_level = max_level;
+    ctx->level = max_level < LZ77_LEVEL_DEFAULT ? max_level : LZ77_LEVEL_DEFAULT;
+    ctx->scratch = mem_arena_new();
+    if (!ctx->scratch) {
+        lz_context_free(ctx);
+        return NULL;
+    }
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (algo != ALGO_AUTO && algo != codec) {
+            continue;
+        }
+        switch (codec) {
+        case ALGO_LZ77:
+            ctx->codecs[codec] = lz77_context_new(max_level);
+            break;
+        case ALGO_LZ78:
+            ctx->codecs[codec] = lz78_context_new();
+            break;
+        case ALGO_LZW:
+            ctx->codecs[codec] = lzw_context_new();
+            break;
+        case ALGO_LZAP:
+            ctx->codecs[codec] = lzap_context_new();
+            break;
+        default:
+            continue;
+        }
+        if (!ctx->codecs[codec]) {
+            lz_context_free(ctx);
+            return NULL;
+        }
+    }
+    return ctx;
+}
+
+void lz_context_reset(LZ_Context *ctx) {
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (!ctx->codecs[codec]) {
+            continue;
+        }
+        void (*fn)(void *);
+        switch (codec) {
+        case ALGO_LZ77:
+            fn = lz77_context_reset;
+            break;
+        case ALGO_LZ78:
+            fn = lz78_context_reset;
+            break;
+        case ALGO_LZW:
+        case ALGO_LZAP:
+            fn = lzw_context_reset;
+            break;
+        default:
+            continue;
+        }
+        fn(ctx->codecs[codec]);
+    }
+}
+
+void lz_context_free(LZ_Context *ctx) {
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (!ctx->codecs[codec]) {
+            continue;
+        }
+        void (*fn)(void *);
+        switch (codec) {
+        case ALGO_LZ77:
+            fn = lz77_context_free;
+            break;
+        case ALGO_LZ78:
+            fn = lz78_context_free;
+            break;
+        case ALGO_LZW:
+        case ALGO_LZAP:
+            fn = lzw_context_free;
+            break;
+        default:
+            continue;
+        }
+        fn(ctx->codecs[codec]);
+    }
+    mem_arena_free(ctx->scratch);
+    mem_free(ctx);
+}
+
+// Bytes held by a context for `algo` before any block is compressed. The codec tables are
+// fixed-size (LZ77's for a given `max_level`); only the buffers that follow the block size
+// come on top.
+size_t lz_context_size(Algo algo, int max_level) {
+    size_t size = sizeof(LZ_Context);
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (algo != ALGO_AUTO && algo != codec) {
+            continue;
+        }
+        switch (codec) {
+        case ALGO_LZ77:
+            size += lz77_context_size(max_level);
+            break;
+        case ALGO_LZ78:
+            size += lz78_context_size();
+            break;
+        case ALGO_LZW:
+            size += lzw_context_size();
+            break;
+        case ALGO_LZAP:
+            size += lzap_context_size();
+            break;
+        default:
+            break;
+        }
+    }
+    return size;
+}
+
+int lz_context_set_dict(LZ_Context *ctx, const Dict *dict) {
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (!ctx->codecs[codec]) {
+            continue;
+        }
+        int (*fn)(void *, const String *);
+        switch (codec) {
+        case ALGO_LZ77:
+            fn = lz77_context_set_dict;
+            break;
+        case ALGO_LZ78:
+            fn = lz78_context_set_dict;
+            break;
+        case ALGO_LZW:
+        case ALGO_LZAP:
+            fn = lzw_context_set_dict;
+            break;
+        default:
+            continue;
+        }
+        if (fn(ctx->codecs[codec], dict->content) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Only LZ77 has levels; the other codecs ignore it. Returns -1 for a level outside
+// LZ77_LEVEL_MIN and the context's `max_level`.
+int lz_context_set_level(LZ_Context *ctx, int level) {
+    if (level < LZ77_LEVEL_MIN || level > ctx->max_level) {
+        return -1;
+    }
+    ctx->level = level;
+    if (ctx->codecs[ALGO_LZ77]) {
+        return lz77_context_set_level(ctx->codecs[ALGO_LZ77], level);
+    }
+    return 0;
+}
+
+void lz_context_set_stats(LZ_Context *ctx, Stats *stats) {
+    ctx->stats = stats;
+    for (Algo codec = 0; codec < ALGO_CODEC_COUNT; ++codec) {
+        if (!ctx->codecs[codec]) {
+            continue;
+        }
+        void (*fn)(void *, Stats *);
+        switch (codec) {
+        case ALGO_LZ77:
+            fn = lz77_context_set_stats;
+            break;
+        case ALGO_LZ78:
+            fn = lz78_context_set_stats;
+            break;
+        case ALGO_LZW:
+        case ALGO_LZAP:
+            fn = lzw_context_set_stats;
+            break;
+        default:
+            continue;
+        }
+        fn(ctx->codecs[codec], stats);
+    }
+}
+
+const char *lz_algo_name(Algo algo) {
     switch (algo) {
     case ALGO_LZ77:
-        return lz77_compress(input);
+        return "LZ77";
     case ALGO_LZ78:
-        return lz78_compress(input);
+        return "LZ78";
     case ALGO_LZW:
-        return lzw_compress(input);
+        return "LZW";
+    case ALGO_LZAP:
+        return "LZAP";
+    case ALGO_AUTO:
+        return "auto";
+    default:
+        break;
     }
     return NULL;
 }
 
-int lz_decompress(Algo algo, const void *compressed, FILE *stream) {
-    String *(*fn)(const void *);
+int lz_compress(LZ_Context *ctx, Algo algo, const String *input, String *out) {
+    int (*fn)(void *, const String *, String *);
     switch (algo) {
     case ALGO_LZ77:
-        fn = lz77_decompress;
+        fn = lz77_compress;
         break;
     case ALGO_LZ78:
-        fn = lz78_decompress;
+        fn = lz78_compress;
         break;
     case ALGO_LZW:
-        fn = lzw_decompress;
+    case ALGO_LZAP:
+        fn = lzw_compress;
         break;
+    default:
+        return -1;
     }
-
-    String *buf = fn(compressed);
-    if (!buf) {
+    if (!ctx->codecs[algo]) {
         return -1;
     }
+    return fn(ctx->codecs[algo], input, out);
+}
 
-    size_t written = fwrite(buf->data, 1, buf->length, stream);
-    if (written != buf->length) {
-        string_free(buf);
+// Decodes into the room already reserved in `out` (its capacity, less the terminator), which
+// is never grown: a block that would decode to more fails, like any other malformed input.
+int lz_decode(LZ_Context *ctx, Algo algo, const uint8_t *src, size_t length, String *out) {
+    int (*fn)(void *, const uint8_t *, size_t, String *);
+    switch (algo) {
+    case ALGO_LZ77:
+        fn = lz77_decode;
+        break;
+    case ALGO_LZ78:
+        fn = lz78_decode;
+        break;
+    case ALGO_LZW:
+    case ALGO_LZAP:
+        fn = lzw_decode;
+        break;
+    default:
         return -1;
     }
-
-    string_free(buf);
-    return 0;
+    if (!ctx->codecs[algo]) {
+        return -1;
+    }
+    return fn(ctx->codecs[algo], src, length, out);
 }
 
 void lz_print(Algo algo, const void *compressed, FILE *stream) {
@@ -131,8 +379,11 @@ void lz_print(Algo algo, const void *compressed, FILE *stream) {
         fn = lz78_print;
         break;
     case ALGO_LZW:
+    case ALGO_LZAP:
         fn = lzw_print;
         break;
+    default:
+        return;
     }
     fn(compressed, stream);
 }
@@ -147,15 +398,95 @@ void lz_free(Algo algo, void *compressed) {
         fn = lz78_free;
         break;
     case ALGO_LZW:
+    case ALGO_LZAP:
         fn = lzw_free;
         break;
+    default:
+        return;
     }
     fn(compressed);
 }
 
+int lz_train(const char *const *pathnames, size_t count, size_t size, FILE *stream) {
+    int retcode = 0;
+    Dict *dict = NULL;
+    String **samples = mem_calloc(count, sizeof(String *));
+    if (!samples) {
+        fprintf(stderr, "error: sample list allocation failed\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        FILE *sample_file = fopen(pathnames[i], "r");
+        if (!sample_file) {
+            fprintf(stderr, "error: sample file '%s' open failed\n", pathnames[i]);
+            retcode = -1;
+            goto cleanup;
+        }
+        samples[i] = string_from_stream(sample_file);
+        fclose(sample_file);
+        if (!samples[i]) {
+            fprintf(stderr, "error: string_from_stream failed\n");
+            retcode = -1;
+            goto cleanup;
+        }
+    }
+
+    dict = dict_train(samples, count, size);
+    if (!dict) {
+        fprintf(stderr, "error: dict_train failed\n");
+        retcode = -1;
+        goto cleanup;
+    }
+    if (dict_write(dict, stream) < 0) {
+        fprintf(stderr, "error: dict_write failed\n");
+        retcode = -1;
+        goto cleanup;
+    }
+
+cleanup:
+    for (size_t i = 0; i < count; ++i) {
+        if (samples[i]) {
+            string_free(samples[i]);
+        }
+    }
+    mem_free(samples);
+    dict_free(dict);
+    return retcode;
+}
+
+// A byte count with an optional K, M or G suffix (powers of 1024).
+int size_parse(const char *str, size_t *size) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    unsigned shift = 0;
+    switch (toupper((unsigned char)*end)) {
+    case 'K':
+        shift = 10;
+        break;
+    case 'M':
+        shift = 20;
+        break;
+    case 'G':
+        shift = 30;
+        break;
+    case '\0':
+        break;
+    default:
+        return -1;
+    }
+    if (end == str || (shift > 0 && end[1] != '\0') || value > (SIZE_MAX >> shift)) {
+        return -1;
+    }
+    *size = (size_t)value << shift;
+    return 0;
+}
+
 typedef enum {
     MODE_COMPRESS,
     MODE_DECOMPRESS,
+    MODE_TEST,
+    MODE_TRAIN,
 } Mode;
 
 int main(int argc, const char *argv[]) {
@@ -165,9 +496,31 @@ int main(int argc, const char *argv[]) {
     bool show_help = false;
     int debug = 0;
     FILE *input_file = NULL;
-    String *input = NULL;
     FILE *output_file = NULL;
-    void *compressed = NULL;
+    // The output file once it has been created, so that a failure can remove it.
+    const char *output_created = NULL;
+    LZ_Context *ctx = NULL;
+    const char *dict_pathname = NULL;
+    size_t dict_size = DICT_DEFAULT_SIZE;
+    Dict *dict = NULL;
+    FrameHeader header = {.block_size = FRAME_DEFAULT_BLOCK_SIZE};
+    bool block_size_set = false;
+    size_t max_memory = 0;
+    bool verify = false;
+    void *verifier = NULL;
+    int level = LZ77_LEVEL_DEFAULT;
+    bool level_set = false;
+    double target_speed = 0;
+    bool show_stats = false;
+    Stats stats = {0};
+    bool has_range = false;
+    Filter filter = FILTER_NONE;
+    bool batch = false;
+    size_t jobs = 0;
+    char **batch_list = NULL;
+    size_t batch_list_count = 0;
+    uint64_t range_start = 0;
+    uint64_t range_length = 0;
 
     int arg_cursor = 0;
     const char *program_name = argv[arg_cursor++];
@@ -182,11 +535,132 @@ int main(int argc, const char *argv[]) {
                 algo = ALGO_LZ78;
             } else if (strcmp(algo_str, "LZW") == 0) {
                 algo = ALGO_LZW;
+            } else if (strcmp(algo_str, "LZAP") == 0) {
+                algo = ALGO_LZAP;
+            } else if (strcmp(algo_str, "auto") == 0) {
+                algo = ALGO_AUTO;
             }
             arg_cursor += 2;
         } else if (strcmp(arg, "-d") == 0 || strcmp(arg, "--decompress") == 0) {
             mode = MODE_DECOMPRESS;
             arg_cursor += 1;
+        } else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--test") == 0) {
+            mode = MODE_TEST;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "-C") == 0 || strcmp(arg, "--checksum") == 0) {
+            header.flags |= FRAME_FLAG_CHECKSUM;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "-D") == 0 || strcmp(arg, "--dict") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            dict_pathname = argv[++i];
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--train") == 0) {
+            mode = MODE_TRAIN;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "--dict-size") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            dict_size = strtoull(argv[++i], NULL, 10);
+            arg_cursor += 2;
+        } else if (strcmp(arg, "-B") == 0 || strcmp(arg, "--block-size") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            unsigned long long block_size = strtoull(argv[++i], NULL, 10);
+            if (block_size == 0 || block_size > UINT32_MAX) {
+                fprintf(stderr, "error: invalid block size '%s'\n", argv[i]);
+                return 1;
+            }
+            header.block_size = block_size;
+            block_size_set = true;
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--max-memory") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            if (size_parse(argv[++i], &max_memory) < 0 || max_memory == 0) {
+                fprintf(stderr, "error: invalid memory size '%s'\n", argv[i]);
+                return 1;
+            }
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--target-speed") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            char *end;
+            target_speed = strtod(argv[++i], &end) * 1e6;
+            if (end == argv[i] || *end != '\0' || !(target_speed > 0)) {
+                fprintf(stderr, "error: invalid speed '%s'\n", argv[i]);
+                return 1;
+            }
+            arg_cursor += 2;
+        } else if (strcmp(arg, "-l") == 0 || strcmp(arg, "--level") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            level = strtol(argv[++i], NULL, 10);
+            if (level < LZ77_LEVEL_MIN || level > LZ77_LEVEL_MAX) {
+                fprintf(stderr, "error: invalid level '%s'\n", argv[i]);
+                return 1;
+            }
+            level_set = true;
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--seekable") == 0) {
+            header.flags |= FRAME_FLAG_SEEKABLE;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "--verify") == 0) {
+            verify = true;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "--long") == 0) {
+            header.flags |= FRAME_FLAG_LONG;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "--batch") == 0) {
+            batch = true;
+            arg_cursor += 1;
+        } else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            jobs = strtoull(argv[++i], NULL, 10);
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--filter") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            if (filter_parse(argv[++i], &filter) < 0) {
+                fprintf(stderr, "error: unknown filter '%s'\n", argv[i]);
+                return 1;
+            }
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--range") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: missing value for '%s'\n", arg);
+                return 1;
+            }
+            const char *range_str = argv[++i];
+            char *end;
+            range_start = strtoull(range_str, &end, 10);
+            if (*end != ':') {
+                fprintf(stderr, "error: invalid range '%s', expected START:LEN\n", range_str);
+                return 1;
+            }
+            range_length = strtoull(end + 1, NULL, 10);
+            has_range = true;
+            arg_cursor += 2;
+        } else if (strcmp(arg, "--stats") == 0) {
+            show_stats = true;
+            arg_cursor += 1;
         } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
             show_help = true;
             arg_cursor += 1;
@@ -202,22 +676,184 @@ int main(int argc, const char *argv[]) {
     if (show_help) {
         printf(
             "Usage: %s [options] [input] [output]\n"
+            "       %s --batch [options] [input...]\n"
+            "       %s --train [options] sample...\n"
             "Compress input file using Lempel-Ziv algorithms.\n"
             "\n"
             "Options:\n"
             "  %-17s %s\n"
             "  %-17s %s\n"
             "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
+            "  %-17s %s\n"
             "  %-17s %s\n",
             program_name,
-            "-a, --algo", "The compression algorithm to use (available: LZ77, LZ78, LZW) (default: LZ77)",
+            program_name,
+            program_name,
+            "-a, --algo", "The compression algorithm to use (available: LZ77, LZ78, LZW, LZAP, auto) (default: LZ77)",
             "-d, --decompress", "Decompress input instead of compressing",
+            "-t, --test", "Decompress input and check it without writing any output",
+            "-C, --checksum", "Store checksums of every block, checked when decompressing",
+            "-D, --dict", "Use a dictionary trained with --train",
+            "-l, --level", "LZ77 match search effort from 1 (fastest) to 9 (smallest output) (default: 5)",
+            "--target-speed", "Retune the LZ77 level after every block to compress at about this many MB/s",
+            "-B, --block-size", "Compress in independent blocks of this many bytes (default: 1048576)",
+            "--seekable", "Append a block index so that --range can decode parts of the output",
+            "--range", "Decompress only bytes START:LEN of a seekable input",
+            "--max-memory", "Fail rather than use more memory than this (K, M, G suffixes); picks the block size and level",
+            "--verify", "Decompress every block again while compressing and fail if it does not match",
+            "--long", "Also deduplicate long repeats at any distance (not with --seekable)",
+            "--filter", "Transform blocks before compressing (available: none, delta:1|2|4|8, shuffle:2|4|8, x86, auto) (default: none)",
+            "--batch", "Write every input (or every file named on stdin) to <input>.lz, or back with -d",
+            "-j, --jobs", "Number of files processed in parallel with --batch (default: one per CPU)",
+            "--train", "Build a dictionary from the sample files and write it to stdout",
+            "--dict-size", "Maximum size in bytes of a trained dictionary (default: 16384)",
+            "--stats", "Print timings and compression statistics as JSON to stderr",
             "--debug-cr", "Print the compressed representation to stderr",
             "-h, --help", "Display this help message"
         );
         goto cleanup;
     }
 
+    if ((header.flags & FRAME_FLAG_LONG) && (header.flags & FRAME_FLAG_SEEKABLE)) {
+        fprintf(stderr, "error: --long cannot be combined with --seekable\n");
+        return 1;
+    }
+
+    mem_set_limit(max_memory);
+
+    if (mode == MODE_TRAIN) {
+        if (arg_cursor >= argc) {
+            fprintf(stderr, "error: --train needs at least one sample file\n");
+            return 1;
+        }
+        if (lz_train(argv + arg_cursor, argc - arg_cursor, dict_size, stdout) < 0) {
+            if (mem_limit_hit()) {
+                fprintf(stderr, "error: --max-memory exceeded\n");
+            }
+            return 1;
+        }
+        return 0;
+    }
+
+    if (dict_pathname) {
+        FILE *dict_file = fopen(dict_pathname, "r");
+        if (!dict_file) {
+            fprintf(stderr, "error: dictionary file '%s' open failed\n", dict_pathname);
+            retcode = 1;
+            goto cleanup;
+        }
+        dict = dict_from_stream(dict_file);
+        fclose(dict_file);
+        if (!dict) {
+            fprintf(stderr, "error: dictionary file '%s' is invalid\n", dict_pathname);
+            retcode = 1;
+            goto cleanup;
+        }
+    }
+
+    if (verify && mode != MODE_COMPRESS) {
+        fprintf(stderr, "error: --verify only applies to compression\n");
+        retcode = 1;
+        goto cleanup;
+    }
+    if (target_speed > 0 && (mode != MODE_COMPRESS || (algo != ALGO_LZ77 && algo != ALGO_AUTO))) {
+        fprintf(stderr, "error: --target-speed only applies to compressing with LZ77 or auto\n");
+        retcode = 1;
+        goto cleanup;
+    }
+
+    // The LZ77 tables are sized for the highest level the context may be set to: the one
+    // asked for, or any with --target-speed. Decoding needs only the smallest.
+    int max_level = LZ77_LEVEL_MIN;
+    if (mode == MODE_COMPRESS) {
+        max_level = target_speed > 0 ? LZ77_LEVEL_MAX : level;
+    }
+    if (max_memory > 0 && mode == MODE_COMPRESS) {
+        // Left after the dictionary; the contexts and block buffers must fit in it. The block
+        // size is picked first, next to the smallest LZ77 tables (or those of an explicit
+        // --level), then the highest level up to the wanted one that fits in what remains.
+        size_t available = max_memory > mem_used() ? max_memory - mem_used() : 0;
+        FrameMemory use = verify ? FRAME_MEMORY_VERIFY : FRAME_MEMORY_COMPRESS;
+        header.algo = algo;
+        int fit_level = level_set ? level : LZ77_LEVEL_MIN;
+        if (!block_size_set) {
+            header.block_size = frame_block_size_for(&header, use, fit_level, available);
+            if (header.block_size == 0) {
+                fprintf(stderr, "error: --max-memory is too small for %s\n", lz_algo_name(algo));
+                retcode = 1;
+                goto cleanup;
+            }
+        } else if (frame_memory_needed(&header, use, fit_level) > available) {
+            fprintf(stderr, "error: block size %u needs about %zu bytes, more than --max-memory allows\n",
+                    header.block_size, frame_memory_needed(&header, use, fit_level));
+            retcode = 1;
+            goto cleanup;
+        }
+        while (max_level > fit_level && frame_memory_needed(&header, use, max_level) > available) {
+            max_level -= 1;
+        }
+        if (level > max_level) {
+            level = max_level;
+        }
+    }
+
+    if (batch) {
+        if (has_range || debug || mode == MODE_TEST) {
+            fprintf(stderr, "error: --batch cannot be combined with --range, --test or --debug-cr\n");
+            retcode = 1;
+            goto cleanup;
+        }
+        const char *const *paths = argv + arg_cursor;
+        size_t count = argc - arg_cursor;
+        if (count == 0 || (count == 1 && strcmp(paths[0], "-") == 0)) {
+            batch_list = batch_read_list(stdin, &batch_list_count);
+            if (!batch_list) {
+                fprintf(stderr, "error: batch_read_list failed\n");
+                retcode = 1;
+                goto cleanup;
+            }
+            paths = (const char *const *)batch_list;
+            count = batch_list_count;
+        }
+        BatchOptions options = {
+            .decompress = mode == MODE_DECOMPRESS,
+            .algo = algo,
+            .filter = filter,
+            .level = level,
+            .max_level = max_level,
+            .verify = verify,
+            .target_speed = target_speed,
+            .header = header,
+            .dict = dict,
+            .jobs = jobs,
+            .stats = show_stats ? &stats : NULL,
+        };
+        if (batch_run(&options, paths, count) < 0) {
+            retcode = 1;
+        }
+        if (show_stats) {
+            stats.peak_memory = mem_peak();
+            stats_print(&stats, lz_algo_name(mode == MODE_DECOMPRESS ? ALGO_AUTO : algo), stderr);
+        }
+        goto cleanup;
+    }
+
     if (arg_cursor >= argc) {
         input_file = stdin;
     } else if (argv[arg_cursor][0] == '-') {
@@ -233,7 +869,9 @@ int main(int argc, const char *argv[]) {
         }
     }
 
-    if (arg_cursor >= argc) {
+    if (mode == MODE_TEST) {
+        // Nothing is written.
+    } else if (arg_cursor >= argc) {
         output_file = stdout;
     } else {
         const char *output_pathname = argv[arg_cursor++];
@@ -243,65 +881,144 @@ int main(int argc, const char *argv[]) {
             retcode = 1;
             goto cleanup;
         }
+        output_created = output_pathname;
     }
 
-    input = string_from_stream(input_file);
-    if (!input) {
-        fprintf(stderr, "error: string_from_stream failed\n");
+    if (mode == MODE_DECOMPRESS || mode == MODE_TEST) {
+        if (frame_header_read(&header, input_file) < 0) {
+            fprintf(stderr, "error: input is not an lz frame\n");
+            retcode = 1;
+            goto cleanup;
+        }
+        algo = header.algo;
+        if ((header.flags & FRAME_FLAG_DICT) && (!dict || dict->id != header.dict_id)) {
+            fprintf(stderr, "error: input needs dictionary %08X\n", header.dict_id);
+            retcode = 1;
+            goto cleanup;
+        }
+        if (max_memory > 0) {
+            size_t needed = frame_decompress_memory_needed(&header, input_file);
+            size_t available = max_memory > mem_used() ? max_memory - mem_used() : 0;
+            if (needed > available) {
+                fprintf(stderr, "error: input needs about %zu bytes, more than --max-memory allows\n", needed);
+                retcode = 1;
+                goto cleanup;
+            }
+        }
+    } else {
+        header.algo = algo;
+        if (dict) {
+            header.flags |= FRAME_FLAG_DICT;
+            header.dict_id = dict->id;
+        }
+    }
+
+    ctx = lz_context_new(algo, max_level);
+    if (!ctx) {
+        fprintf(stderr, "error: lz_context_new failed\n");
         retcode = 1;
         goto cleanup;
     }
-
-    switch (mode) {
-    case MODE_COMPRESS: {
-        compressed = lz_compress(algo, input);
-        if (!compressed) {
-            fprintf(stderr, "error: lz_compress failed\n");
+    if ((header.flags & FRAME_FLAG_DICT) && lz_context_set_dict(ctx, dict) < 0) {
+        fprintf(stderr, "error: lz_context_set_dict failed\n");
+        retcode = 1;
+        goto cleanup;
+    }
+    ctx->filter = filter;
+    if (mode == MODE_COMPRESS && lz_context_set_level(ctx, level) < 0) {
+        fprintf(stderr, "error: invalid level %d\n", level);
+        retcode = 1;
+        goto cleanup;
+    }
+    ctx->target_speed = target_speed;
+    if (show_stats) {
+        lz_context_set_stats(ctx, &stats);
+    }
+    if (debug & DEBUG_COMPRESSED_REPR) {
+        ctx->debug = stderr;
+    }
+    if (verify) {
+        verifier = verify_new(algo, (header.flags & FRAME_FLAG_DICT) ? dict : NULL);
+        if (!verifier) {
+            fprintf(stderr, "error: verify_new failed\n");
             retcode = 1;
             goto cleanup;
         }
-        if (debug & DEBUG_COMPRESSED_REPR) {
-            lz_print(algo, compressed, stderr);
-        }
-        if (lz_serialize(algo, compressed, output_file) < 0) {
-            fprintf(stderr, "error: lz_serialize failed\n");
+        ctx->verifier = verifier;
+    }
+
+    switch (mode) {
+    case MODE_COMPRESS: {
+        if (frame_compress(ctx, &header, input_file, output_file) < 0) {
+            uint64_t offset;
+            if (verifier && verify_failed(verifier, &offset)) {
+                fprintf(stderr, "error: --verify: block at offset %llu does not decompress to its input\n",
+                        (unsigned long long)offset);
+            } else {
+                fprintf(stderr, "error: frame_compress failed\n");
+            }
             retcode = 1;
             goto cleanup;
         }
         break;
     }
     case MODE_DECOMPRESS: {
-        compressed = lz_deserialize(algo, input_file);
-        if (!compressed) {
-            fprintf(stderr, "error: lz_deserialize failed\n");
+        if (has_range) {
+            if (!(header.flags & FRAME_FLAG_SEEKABLE)) {
+                fprintf(stderr, "error: --range needs an input compressed with --seekable\n");
+                retcode = 1;
+                goto cleanup;
+            }
+            if (frame_decompress_range(ctx, &header, input_file, range_start, range_length, output_file) < 0) {
+                fprintf(stderr, "error: frame_decompress_range failed\n");
+                retcode = 1;
+                goto cleanup;
+            }
+        } else if (frame_decompress(ctx, &header, input_file, output_file) < 0) {
+            fprintf(stderr, "error: frame_decompress failed\n");
             retcode = 1;
             goto cleanup;
         }
-        if (debug & DEBUG_COMPRESSED_REPR) {
-            lz_print(algo, compressed, stderr);
-        }
-        if (lz_decompress(algo, compressed, output_file) < 0) {
-            fprintf(stderr, "error: lz_decompress failed\n");
+        break;
+    }
+    case MODE_TEST: {
+        if (frame_decompress(ctx, &header, input_file, NULL) < 0) {
+            fprintf(stderr, "error: input is damaged\n");
             retcode = 1;
             goto cleanup;
         }
         break;
     }
+    case MODE_TRAIN:
+        break;
+    }
+
+    if (show_stats) {
+        stats.peak_memory = mem_peak();
+        stats_print(&stats, lz_algo_name(algo), stderr);
     }
 
 cleanup:
+    if (retcode != 0 && mem_limit_hit()) {
+        fprintf(stderr, "error: --max-memory exceeded\n");
+    }
     if (input_file) {
         fclose(input_file);
     }
-    if (input) {
-        string_free(input);
+    if (output_file && fclose(output_file) != 0 && retcode == 0) {
+        fprintf(stderr, "error: output write failed\n");
+        retcode = 1;
     }
-    if (output_file) {
-        fclose(output_file);
+    // A partial output is worse than none, as with --batch.
+    if (retcode != 0 && output_created) {
+        remove(output_created);
     }
-    if (compressed) {
-        lz_free(algo, compressed);
+    if (ctx) {
+        lz_context_free(ctx);
     }
+    verify_free(verifier);
+    batch_free_list(batch_list, batch_list_count);
+    dict_free(dict);
     return retcode;
 }
 
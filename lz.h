@@ -8,26 +8,91 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "dict.h"
+#include "filter.h"
 #include "lz77.h"
 #include "lz78.h"
 #include "lzw.h"
+#include "stats.h"
 #include "string.h"
 
 typedef enum {
     ALGO_LZ77,
     ALGO_LZ78,
     ALGO_LZW,
+    ALGO_LZAP,
+    ALGO_CODEC_COUNT,
+    // Not a codec: picks one of the above for every block.
+    ALGO_AUTO = 0x80,
 } Algo;
 
+// Holds a codec context for `algo`, or one for every codec with ALGO_AUTO. `filter` only
+// applies to compression; decoding reads it from every block. `scratch` is a mem arena for
+// buffers that only live while one block is processed. `verifier`, when set, checks every
+// compressed block (see verify.h). With a `target_speed` (input bytes per second), the LZ77
+// `level` is retuned after every block; `level_speeds` holds the last throughput seen at each.
+// The LZ77 tables are sized for `max_level`, which the level never exceeds.
+typedef struct {
+    Algo algo;
+    Filter filter;
+    void *codecs[ALGO_CODEC_COUNT];
+    void *scratch;
+    Stats *stats;
+    FILE *debug;
+    void *verifier;
+    int level;
+    int max_level;
+    double target_speed;
+    double level_speeds[LZ77_LEVEL_MAX + 1];
+} LZ_Context;
+
+#define ESCAPE_CHAR_BUF_SIZE 5
+
 void uint8_be_write(uint8_t *buf, uint8_t value);
 
 void uint16_be_write(uint8_t *buf, uint16_t value);
 
-uint8_t uint8_be_read(uint8_t *buf);
+void uint32_be_write(uint8_t *buf, uint32_t value);
+
+void uint64_be_write(uint8_t *buf, uint64_t value);
+
+uint8_t uint8_be_read(const uint8_t *buf);
+
+uint16_t uint16_be_read(const uint8_t *buf);
+
+uint32_t uint32_be_read(const uint8_t *buf);
+
+uint64_t uint64_be_read(const uint8_t *buf);
+
+const char *escape_char(char ch, char *buf);
+
+size_t byte_run_length(const uint8_t *data, size_t length);
+
+LZ_Context *lz_context_new(Algo algo, int max_level);
+
+void lz_context_reset(LZ_Context *ctx);
+
+void lz_context_free(LZ_Context *ctx);
+
+size_t lz_context_size(Algo algo, int max_level);
+
+int lz_context_set_dict(LZ_Context *ctx, const Dict *dict);
+
+void lz_context_set_stats(LZ_Context *ctx, Stats *stats);
+
+int lz_context_set_level(LZ_Context *ctx, int level);
+
+const char *lz_algo_name(Algo algo);
+
+void *lz_deserialize(Algo algo, FILE *stream);
+
+int lz_compress(LZ_Context *ctx, Algo algo, const String *input, String *out);
+
+int lz_decode(LZ_Context *ctx, Algo algo, const uint8_t *src, size_t length, String *out);
 
-uint16_t uint16_be_read(uint8_t *buf);
+void lz_print(Algo algo, const void *compressed, FILE *stream);
 
-const char *escape_char(char ch);
+void lz_free(Algo algo, void *compressed);
 
 #endif // LZ_H
 
@@ -8,187 +8,596 @@
 #include <string.h>
 
 #include "lz.h"
+#include "mem.h"
 #include "string.h"
 
+// A block is a sequence list: each sequence copies a run of literals and then (except possibly
+// in the last one) a match. Its fields go to separate streams, so literals stay contiguous
+// and each stream holds values of one kind:
+//   header   sequence count (4), and the byte lengths of the literal (4), run (4) and
+//            offset (4) streams
+//   literals the literal bytes of all runs, in order
+//   runs     per sequence the literal run length: bytes of 255 followed by the remainder
+//   lengths  per sequence the match length (1), 0 only when there is no match
+//   offsets  per match either LZ77_REP_TAG + i (1) for the i-th most recently used offset, or
+//            the offset (2), which therefore stays below LZ77_REP_TAG << 8
+#define LZ77_REP_COUNT 3
+#define LZ77_REP_TAG (0x100 - LZ77_REP_COUNT)
+#define LZ77_HEADER_SIZE 16
+
 typedef struct {
+    uint32_t literal_length;
     uint16_t offset;
     uint8_t length;
-    uint8_t symbol;
-} LZ77_Tuple;
+    // 1 + the repeat-offset index, or 0 for an explicit offset.
+    uint8_t rep;
+} LZ77_Sequence;
 
 typedef struct {
+    String *literals;
     size_t capacity;
     size_t length;
-    LZ77_Tuple data[];
-} LZ77_TupleList;
+    LZ77_Sequence data[];
+} LZ77_SequenceList;
 
-LZ77_TupleList *lz77_tuple_list_new(size_t capacity) {
-    LZ77_TupleList *list = malloc(sizeof(LZ77_TupleList) + sizeof(LZ77_Tuple) * capacity);
-    if (!list) {
-        return NULL;
-    }
-    list->capacity = capacity;
-    list->length = 0;
-    memset(list->data, 0, sizeof(LZ77_Tuple) * capacity);
-    return list;
-}
+// A parsed block: a cursor into each stream.
+typedef struct {
+    size_t sequences;
+    const uint8_t *literals;
+    const uint8_t *literals_end;
+    const uint8_t *runs;
+    const uint8_t *runs_end;
+    const uint8_t *lengths;
+    const uint8_t *offsets;
+    const uint8_t *offsets_end;
+} LZ77_Streams;
 
-int lz77_tuple_list_push(LZ77_TupleList *list, const LZ77_Tuple *tuple) {
-    if (list->length >= list->capacity) {
+int lz77_streams_parse(LZ77_Streams *streams, const uint8_t *src, size_t length) {
+    if (length < LZ77_HEADER_SIZE) {
         return -1;
     }
-    list->data[list->length++] = *tuple;
+    uint64_t sequences = uint32_be_read(src);
+    uint64_t literals_length = uint32_be_read(src + 4);
+    uint64_t runs_length = uint32_be_read(src + 8);
+    uint64_t offsets_length = uint32_be_read(src + 12);
+    if (LZ77_HEADER_SIZE + literals_length + runs_length + sequences + offsets_length != length) {
+        return -1;
+    }
+    streams->sequences = sequences;
+    streams->literals = src + LZ77_HEADER_SIZE;
+    streams->literals_end = streams->literals + literals_length;
+    streams->runs = streams->literals_end;
+    streams->runs_end = streams->runs + runs_length;
+    streams->lengths = streams->runs_end;
+    streams->offsets = streams->lengths + sequences;
+    streams->offsets_end = streams->offsets + offsets_length;
     return 0;
 }
 
-int lz77_serialize(const void *compressed, FILE *stream) {
-    const LZ77_TupleList *list = compressed;
-    for (size_t i = 0; i < list->length; ++i) {
-        const LZ77_Tuple *tuple = &list->data[i];
-        uint8_t buf[4];
-        uint16_be_write(buf, tuple->offset);
-        uint8_be_write(buf + 2, tuple->length);
-        uint8_be_write(buf + 3, tuple->symbol);
-        size_t written = fwrite(buf, 1, sizeof(buf), stream);
-        if (written != sizeof(buf)) {
+// Reads the next sequence's run length, match length and offset (0 when there is no match),
+// advancing the run, length and offset cursors. The literals are left to the caller.
+int lz77_streams_next(LZ77_Streams *streams, size_t *run, size_t *length, size_t *offset, int *rep) {
+    *run = 0;
+    while (true) {
+        if (streams->runs == streams->runs_end) {
             return -1;
         }
+        uint8_t byte = *streams->runs++;
+        *run += byte;
+        if (byte != 0xFF) {
+            break;
+        }
+    }
+    *length = *streams->lengths++;
+    *offset = 0;
+    *rep = -1;
+    if (*length == 0) {
+        return 0;
+    }
+    if (streams->offsets == streams->offsets_end) {
+        return -1;
     }
+    if (*streams->offsets >= LZ77_REP_TAG) {
+        *rep = *streams->offsets++ - LZ77_REP_TAG;
+        return 0;
+    }
+    if (streams->offsets_end - streams->offsets < 2) {
+        return -1;
+    }
+    *offset = uint16_be_read(streams->offsets);
+    streams->offsets += 2;
     return 0;
 }
 
 void *lz77_deserialize(FILE *stream) {
     bool error = false;
-    LZ77_TupleList *list = NULL;
+    String *payload = NULL;
+    LZ77_SequenceList *list = NULL;
 
-    fseek(stream, 0, SEEK_END);
-    long file_size = ftell(stream);
-    rewind(stream);
-
-    list = lz77_tuple_list_new(file_size);
+    payload = string_from_stream(stream);
+    LZ77_Streams streams;
+    if (!payload || lz77_streams_parse(&streams, payload->data, payload->length) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    list = mem_alloc(sizeof(LZ77_SequenceList) + sizeof(LZ77_Sequence) * streams.sequences);
     if (!list) {
         error = true;
         goto cleanup;
     }
+    list->capacity = streams.sequences;
+    list->length = 0;
+    size_t literals_length = streams.literals_end - streams.literals;
+    list->literals = string_with_capacity(literals_length + 1);
+    if (!list->literals || string_append(list->literals, streams.literals, literals_length) < 0) {
+        error = true;
+        goto cleanup;
+    }
 
-    while (true) {
-        uint8_t buf[4];
-        size_t read = fread(buf, 1, sizeof(buf), stream);
-        if (read != sizeof(buf)) {
-            if (feof(stream)) {
-                break;
-            }
+    for (size_t i = 0; i < streams.sequences; ++i) {
+        size_t run, length, offset;
+        int rep;
+        if (lz77_streams_next(&streams, &run, &length, &offset, &rep) < 0) {
             error = true;
             goto cleanup;
         }
-        LZ77_Tuple cr = {
-            .offset = uint16_be_read(buf),
-            .length = uint8_be_read(buf + 2),
-            .symbol = uint8_be_read(buf + 3),
+        list->data[list->length++] = (LZ77_Sequence){
+            .literal_length = run,
+            .offset = offset,
+            .length = length,
+            .rep = rep + 1,
         };
-        if (lz77_tuple_list_push(list, &cr) < 0) {
-            error = true;
-            goto cleanup;
-        }
     }
 
-    cleanup:
+cleanup:
+    if (payload) {
+        string_free(payload);
+    }
     if (error) {
-        free(list);
+        lz77_free(list);
         return NULL;
     }
     return list;
 }
 
-void *lz77_compress(const String *input) {
-    bool error = false;
-    LZ77_TupleList *list = NULL;
+#define LZ77_WINDOW_SIZE ((LZ77_REP_TAG << 8) - 1)
+#define LZ77_MIN_MATCH 3
+// A match with an explicit offset costs 4 bytes across the streams and a repeat match 3, so
+// shorter explicit matches are left as literals (1 byte each).
+#define LZ77_MIN_OFFSET_MATCH 5
+#define LZ77_MAX_MATCH UINT8_MAX
+// Runs of a repeated byte at least this long skip the match finder: they are emitted as
+// offset-1 matches straight away and only their tail is hashed.
+#define LZ77_RUN_MIN_LENGTH 32
+// The piece size of the decoder's unchecked copies: short literal runs are one such copy.
+#define LZ77_WILD_COPY 16
 
-    list = lz77_tuple_list_new(input->length);
-    if (!list) {
-        error = true;
-        goto cleanup;
+// Match finder settings. Matches are searched at most `window` bytes back (at most
+// LZ77_WINDOW_SIZE, which the offsets can express), through chains of positions that share a
+// hash of their first `hash_bytes` bytes, following at most `chain` links.
+typedef struct {
+    size_t window;
+    unsigned hash_bytes;
+    unsigned hash_bits;
+    size_t chain;
+} LZ77_Params;
+
+// Lower levels find fewer and closer matches, faster.
+const LZ77_Params lz77_levels[LZ77_LEVEL_MAX + 1] = {
+    [1] = {.window = 16383, .hash_bytes = 5, .hash_bits = 12, .chain = 4},
+    [2] = {.window = 32767, .hash_bytes = 4, .hash_bits = 14, .chain = 8},
+    [3] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 4, .hash_bits = 15, .chain = 16},
+    [4] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 4, .hash_bits = 15, .chain = 48},
+    [5] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 3, .hash_bits = 15, .chain = 128},
+    [6] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 3, .hash_bits = 15, .chain = 384},
+    [7] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 3, .hash_bits = 15, .chain = 1024},
+    [8] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 3, .hash_bits = 15, .chain = 4096},
+    [9] = {.window = LZ77_WINDOW_SIZE, .hash_bytes = 3, .hash_bits = 15, .chain = 16384},
+};
+
+// Positions are stored as `i + 1` (0 means none), where `i` indexes the dictionary followed by
+// the input. A head entry is only live when its stamp matches the context's; otherwise the
+// chain starts from the dictionary's own head table, so resetting is a single increment.
+// The tables follow the context in the same mapping, sized for the highest level it may be
+// set to: lower levels hash fewer bits over a shorter window, so a context limited to them
+// is smaller.
+typedef struct LZ77_Context LZ77_Context;
+
+// A match finder, compiled from lz77_kernel.h for one hash and window (a generic one has
+// them all 0 and reads ctx->params).
+typedef struct {
+    unsigned hash_bytes;
+    unsigned hash_bits;
+    size_t window;
+    uint32_t (*hash)(const LZ77_Context *ctx, const uint8_t *data);
+    int (*parse)(LZ77_Context *ctx, const uint8_t *data, size_t start, size_t length);
+} LZ77_Kernel;
+
+struct LZ77_Context {
+    Stats *stats;
+    LZ77_Params params;
+    const LZ77_Kernel *kernel;
+    uint32_t stamp;
+    String *window;
+    size_t dict_length;
+    size_t reps[LZ77_REP_COUNT];
+    size_t sequences;
+    String *literals;
+    String *runs;
+    String *lengths;
+    String *offsets;
+    int max_level;
+    size_t hash_size;
+    uint32_t prev_mask;
+    uint32_t *head;
+    uint32_t *head_stamp;
+    uint32_t *dict_head;
+    uint32_t *prev;
+};
+
+// The table sizes for levels up to `max_level`. The prev ring only has to outlast the
+// window, since a chain is followed no further back than that.
+void lz77_table_sizes(int max_level, size_t *hash_size, size_t *prev_size) {
+    unsigned hash_bits = 0;
+    size_t window = 0;
+    for (int level = LZ77_LEVEL_MIN; level <= max_level; ++level) {
+        if (lz77_levels[level].hash_bits > hash_bits) {
+            hash_bits = lz77_levels[level].hash_bits;
+        }
+        if (lz77_levels[level].window > window) {
+            window = lz77_levels[level].window;
+        }
     }
+    *hash_size = (size_t)1 << hash_bits;
+    for (*prev_size = 1; *prev_size <= window; *prev_size *= 2) {
+    }
+}
 
-    for (size_t lookahead = 0; lookahead < input->length;) {
-        size_t match_offset = 0;
-        size_t match_length = 0;
-        for (size_t start = lookahead; start-- > 0;) {
-            size_t length = 0;
-            while (start + length < input->length &&
-                lookahead + length < input->length &&
-                input->data[start + length] == input->data[lookahead + length]) {
-                length += 1;
-            }
-            if (length > match_length) { 
-                match_length = length;
-                match_offset = lookahead - start;
-            }
+size_t lz77_context_size(int max_level) {
+    size_t hash_size, prev_size;
+    lz77_table_sizes(max_level, &hash_size, &prev_size);
+    return sizeof(LZ77_Context) + sizeof(uint32_t) * (3 * hash_size + prev_size);
+}
+
+// A context that can be set to any level up to `max_level`.
+void *lz77_context_new(int max_level) {
+    if (max_level < LZ77_LEVEL_MIN || max_level > LZ77_LEVEL_MAX) {
+        return NULL;
+    }
+    // Zero-filled, and the part of a table a narrower hash leaves out is never touched.
+    LZ77_Context *ctx = mem_map(lz77_context_size(max_level));
+    if (!ctx) {
+        return NULL;
+    }
+    size_t prev_size;
+    lz77_table_sizes(max_level, &ctx->hash_size, &prev_size);
+    ctx->max_level = max_level;
+    ctx->prev_mask = prev_size - 1;
+    ctx->head = (uint32_t *)(ctx + 1);
+    ctx->head_stamp = ctx->head + ctx->hash_size;
+    ctx->dict_head = ctx->head_stamp + ctx->hash_size;
+    ctx->prev = ctx->dict_head + ctx->hash_size;
+    ctx->window = string_new();
+    ctx->literals = string_new();
+    ctx->runs = string_new();
+    ctx->lengths = string_new();
+    ctx->offsets = string_new();
+    if (!ctx->window || !ctx->literals || !ctx->runs || !ctx->lengths || !ctx->offsets) {
+        lz77_context_free(ctx);
+        return NULL;
+    }
+    ctx->stamp = 1;
+    lz77_context_set_level(ctx, max_level < LZ77_LEVEL_DEFAULT ? max_level : LZ77_LEVEL_DEFAULT);
+    return ctx;
+}
+
+void lz77_context_reset(void *ctx_) {
+    LZ77_Context *ctx = ctx_;
+    if (ctx->stamp == UINT32_MAX) {
+        memset(ctx->head_stamp, 0, sizeof(uint32_t) * ctx->hash_size);
+        ctx->stamp = 0;
+    }
+    ctx->stamp += 1;
+}
+
+// Both sides keep the most recently used offsets in the same order: a repeated offset moves to
+// the front, a new one is pushed in front. Literals leave them alone.
+void lz77_reps_init(size_t *reps) {
+    for (size_t i = 0; i < LZ77_REP_COUNT; ++i) {
+        reps[i] = i + 1;
+    }
+}
+
+int lz77_reps_find(const size_t *reps, size_t offset) {
+    for (int i = 0; i < LZ77_REP_COUNT; ++i) {
+        if (reps[i] == offset) {
+            return i;
         }
+    }
+    return -1;
+}
 
-        // WARNING: The null character ('\0') is used to indicate that there is no remaining symbol to emit.
-        // This makes the implementation incompatible with binary input, where '\0' may be a valid data byte.
-        LZ77_Tuple tuple = {
-            .offset = match_offset,
-            .length = match_length,
-            .symbol = lookahead + match_length < input->length ? input->data[lookahead + match_length] : '\0',
-        };
-        if (lz77_tuple_list_push(list, &tuple) < 0) {
-            error = true;
-            goto cleanup;
+void lz77_reps_update(size_t *reps, int rep, size_t offset) {
+    size_t i = rep >= 0 ? (size_t)rep : LZ77_REP_COUNT - 1;
+    for (; i > 0; --i) {
+        reps[i] = reps[i - 1];
+    }
+    reps[0] = offset;
+}
+
+void lz77_context_set_stats(void *ctx_, Stats *stats) {
+    LZ77_Context *ctx = ctx_;
+    ctx->stats = stats;
+}
+
+void lz77_context_free(void *ctx_) {
+    LZ77_Context *ctx = ctx_;
+    String *buffers[] = {ctx->window, ctx->literals, ctx->runs, ctx->lengths, ctx->offsets};
+    for (size_t i = 0; i < sizeof(buffers) / sizeof(buffers[0]); ++i) {
+        if (buffers[i]) {
+            string_free(buffers[i]);
         }
-        lookahead += match_length + 1;
     }
+    mem_unmap(ctx, lz77_context_size(ctx->max_level));
+}
 
-    cleanup:
-    if (error) {
-        free(list);
-        return NULL;
+uint32_t lz77_head(const LZ77_Context *ctx, uint32_t hash) {
+    return ctx->head_stamp[hash] == ctx->stamp ? ctx->head[hash] : ctx->dict_head[hash];
+}
+
+// Chains the dictionary's positions with the current kernel's hash.
+void lz77_dict_hash(LZ77_Context *ctx) {
+    memset(ctx->dict_head, 0, sizeof(uint32_t) * ctx->hash_size);
+    lz77_context_reset(ctx);
+    for (size_t pos = 0; pos + ctx->params.hash_bytes <= ctx->dict_length; ++pos) {
+        uint32_t hash = ctx->kernel->hash(ctx, ctx->window->data + pos);
+        ctx->prev[(pos + 1) & ctx->prev_mask] = ctx->dict_head[hash];
+        ctx->dict_head[hash] = pos + 1;
     }
-    return list;
 }
 
-String *lz77_decompress(const void *compressed) {
-    const LZ77_TupleList *list = compressed;
-    bool error = false;
-    String *buf = NULL;
+// The dictionary acts as a preset window: its positions are hashed once here and the
+// input is appended after it, so matches may reach back into it.
+int lz77_context_set_dict(void *ctx_, const String *dict) {
+    LZ77_Context *ctx = ctx_;
+    size_t length = dict->length < LZ77_WINDOW_SIZE ? dict->length : LZ77_WINDOW_SIZE;
+    if (string_reserve(ctx->window, length + 1) < 0) {
+        return -1;
+    }
+    memcpy(ctx->window->data, dict->data + dict->length - length, length);
+    ctx->window->length = length;
+    ctx->dict_length = length;
 
-    buf = string_new();
-    if (!buf) {
-        error = true;
-        goto cleanup;
+    lz77_dict_hash(ctx);
+    return 0;
+}
+
+size_t lz77_match_length(const uint8_t *a, const uint8_t *b, size_t max_length) {
+    size_t length = 0;
+    while (length < max_length && a[length] == b[length]) {
+        length += 1;
     }
-    for (size_t i = 0; i < list->length; ++i) {
-        const LZ77_Tuple *tuple = &list->data[i];
-        for (size_t j = 0; j < tuple->length; ++j) {
-            if (string_push(buf, buf->data[buf->length - tuple->offset]) < 0) {
-                error = true;
-                goto cleanup;
+    return length;
+}
+
+// Appends a sequence to the stream buffers; lz77_compress joins them once the block is done.
+int lz77_emit(LZ77_Context *ctx, const uint8_t *literals, size_t run, size_t length, size_t offset, int rep) {
+    if (string_append(ctx->literals, literals, run) < 0) {
+        return -1;
+    }
+    for (; run >= 0xFF; run -= 0xFF) {
+        if (string_push(ctx->runs, 0xFF) < 0) {
+            return -1;
+        }
+    }
+    if (string_push(ctx->runs, run) < 0 || string_push(ctx->lengths, length) < 0) {
+        return -1;
+    }
+    if (length > 0) {
+        if (rep >= 0) {
+            if (string_push(ctx->offsets, LZ77_REP_TAG + rep) < 0) {
+                return -1;
             }
+        } else if (string_push(ctx->offsets, offset >> 8) < 0 || string_push(ctx->offsets, offset & 0xFF) < 0) {
+            return -1;
+        }
+    }
+    ctx->sequences += 1;
+    return 0;
+}
+
+// Emits the `run` bytes at `*pos`, which repeat the byte before them, as maximum-length
+// offset-1 matches, the first one carrying the pending literals, and advances `*pos` past
+// them; a last piece too short for a match is left over.
+int lz77_compress_run(LZ77_Context *ctx, const uint8_t *data, size_t literal_start, size_t *pos, size_t run) {
+    size_t end = *pos + run;
+    while (end - *pos >= LZ77_MIN_MATCH) {
+        size_t match_length = end - *pos < LZ77_MAX_MATCH ? end - *pos : LZ77_MAX_MATCH;
+        int rep = lz77_reps_find(ctx->reps, 1);
+        if (lz77_emit(ctx, data + literal_start, *pos - literal_start, match_length, 1, rep) < 0) {
+            return -1;
+        }
+        lz77_reps_update(ctx->reps, rep, 1);
+        if (ctx->stats) {
+            stats_match(ctx->stats, match_length, 1);
+            if (rep >= 0) {
+                ctx->stats->rep_matches += 1;
+            }
+        }
+        *pos += match_length;
+        literal_start = *pos;
+    }
+    return 0;
+}
+
+#define LZ77_KERNEL_NAME h5
+#define LZ77_KERNEL_HASH_BYTES 5
+#define LZ77_KERNEL_HASH_BITS 12
+#define LZ77_KERNEL_WINDOW 16383
+#include "lz77_kernel.h"
+
+#define LZ77_KERNEL_NAME h4
+#define LZ77_KERNEL_HASH_BYTES 4
+#define LZ77_KERNEL_HASH_BITS 15
+#define LZ77_KERNEL_WINDOW LZ77_WINDOW_SIZE
+#include "lz77_kernel.h"
+
+#define LZ77_KERNEL_NAME h3
+#define LZ77_KERNEL_HASH_BYTES 3
+#define LZ77_KERNEL_HASH_BITS 15
+#define LZ77_KERNEL_WINDOW LZ77_WINDOW_SIZE
+#include "lz77_kernel.h"
+
+#define LZ77_KERNEL_NAME generic
+#define LZ77_KERNEL_GENERIC
+#include "lz77_kernel.h"
+
+#define LZ77_KERNEL_NAME plain
+#define LZ77_KERNEL_DICT 0
+#include "lz77_kernel.h"
+
+#define LZ77_KERNEL_NAME dict
+#define LZ77_KERNEL_DICT 1
+#include "lz77_kernel.h"
+
+// Searched in order; the generic kernel takes any parameters and must come last.
+const LZ77_Kernel *const lz77_kernels[] = {&lz77_kernel_h5, &lz77_kernel_h4, &lz77_kernel_h3, &lz77_kernel_generic};
+
+int (*const lz77_decoders[2])(const LZ77_Context *, LZ77_Streams *, String *, size_t *) = {
+    lz77_decode_plain,
+    lz77_decode_dict,
+};
+
+// Picks the level's parameters and the kernel compiled for them, once per context rather than
+// per block. Returns -1 for an unknown level, or one above what the context was sized for.
+int lz77_context_set_level(void *ctx_, int level) {
+    LZ77_Context *ctx = ctx_;
+    if (level < LZ77_LEVEL_MIN || level > ctx->max_level) {
+        return -1;
+    }
+    ctx->params = lz77_levels[level];
+    for (size_t i = 0; i < sizeof(lz77_kernels) / sizeof(lz77_kernels[0]); ++i) {
+        const LZ77_Kernel *kernel = lz77_kernels[i];
+        if (kernel->hash_bytes == 0 || (kernel->hash_bytes == ctx->params.hash_bytes &&
+                                        kernel->hash_bits == ctx->params.hash_bits &&
+                                        kernel->window == ctx->params.window)) {
+            ctx->kernel = kernel;
+            break;
         }
-        if (tuple->symbol != '\0' && string_push(buf, tuple->symbol) < 0) {
+    }
+    if (ctx->dict_length > 0) {
+        lz77_dict_hash(ctx);
+    }
+    return 0;
+}
+
+int lz77_compress(void *ctx_, const String *input, String *out) {
+    LZ77_Context *ctx = ctx_;
+    bool error = false;
+
+    lz77_context_reset(ctx);
+    lz77_reps_init(ctx->reps);
+
+    const uint8_t *data = input->data;
+    size_t start = 0;
+    size_t length = input->length;
+    if (ctx->dict_length > 0) {
+        ctx->window->length = ctx->dict_length;
+        if (string_reserve(ctx->window, ctx->dict_length + input->length + 1) < 0) {
             error = true;
             goto cleanup;
         }
+        memcpy(ctx->window->data + ctx->dict_length, input->data, input->length);
+        data = ctx->window->data;
+        start = ctx->dict_length;
+        length = ctx->dict_length + input->length;
+    }
+    if (length >= UINT32_MAX) {
+        error = true;
+        goto cleanup;
     }
 
-cleanup:
-    if (error) {
-        string_free(buf);
-        return NULL;
+    ctx->sequences = 0;
+    ctx->literals->length = 0;
+    ctx->runs->length = 0;
+    ctx->lengths->length = 0;
+    ctx->offsets->length = 0;
+
+    if (ctx->kernel->parse(ctx, data, start, length) < 0) {
+        error = true;
+        goto cleanup;
     }
-    return buf;
+
+    const String *streams[] = {ctx->literals, ctx->runs, ctx->lengths, ctx->offsets};
+    size_t total = LZ77_HEADER_SIZE;
+    for (size_t i = 0; i < 4; ++i) {
+        total += streams[i]->length;
+    }
+    if (ctx->sequences > UINT32_MAX || total > UINT32_MAX || string_grow(out, total) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    uint8_t *header = out->data + out->length;
+    uint32_be_write(header, ctx->sequences);
+    uint32_be_write(header + 4, ctx->literals->length);
+    uint32_be_write(header + 8, ctx->runs->length);
+    uint32_be_write(header + 12, ctx->offsets->length);
+    out->length += LZ77_HEADER_SIZE;
+    for (size_t i = 0; i < 4; ++i) {
+        memcpy(out->data + out->length, streams[i]->data, streams[i]->length);
+        out->length += streams[i]->length;
+    }
+    out->data[out->length] = '\0';
+
+    cleanup:
+    return error ? -1 : 0;
+}
+
+// Decodes a block straight into `out`, which must contain only output of the same block (if
+// anything). Literal runs are bulk copies; offsets may reach back into the dictionary.
+int lz77_decode(void *ctx_, const uint8_t *src, size_t length, String *out) {
+    LZ77_Context *ctx = ctx_;
+    LZ77_Streams streams;
+    if (lz77_streams_parse(&streams, src, length) < 0) {
+        return -1;
+    }
+    size_t tokens = 0;
+    if (lz77_decoders[ctx->dict_length > 0](ctx, &streams, out, &tokens) < 0) {
+        return -1;
+    }
+    if (streams.literals != streams.literals_end || streams.runs != streams.runs_end ||
+        streams.offsets != streams.offsets_end) {
+        return -1;
+    }
+    if (ctx->stats) {
+        ctx->stats->tokens += tokens;
+    }
+    return 0;
 }
 
 void lz77_print(const void *compressed, FILE *stream) {
-    const LZ77_TupleList *list = compressed;
+    const LZ77_SequenceList *list = compressed;
+    const uint8_t *literals = list->literals->data;
     for (size_t i = 0; i < list->length; ++i) {
-        const LZ77_Tuple *tuple = &list->data[i];
-        fprintf(stream, "(%d, %d, '%s')\n", tuple->offset, tuple->length, escape_char(tuple->symbol));
+        const LZ77_Sequence *sequence = &list->data[i];
+        fputs("(\"", stream);
+        for (size_t j = 0; j < sequence->literal_length; ++j) {
+            char escaped[ESCAPE_CHAR_BUF_SIZE];
+            fputs(escape_char(*literals++, escaped), stream);
+        }
+        if (sequence->rep && sequence->length > 0) {
+            fprintf(stream, "\", rep%d, %d)\n", sequence->rep - 1, sequence->length);
+        } else {
+            fprintf(stream, "\", %d, %d)\n", sequence->offset, sequence->length);
+        }
     }
 }
 
 void lz77_free(void *compressed) {
-    free(compressed);
+    LZ77_SequenceList *list = compressed;
+    if (list && list->literals) {
+        string_free(list->literals);
+    }
+    mem_free(list);
 }
 
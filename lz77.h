@@ -8,15 +8,32 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "stats.h"
 #include "string.h"
 
-int lz77_serialize(const void *compressed, FILE *stream);
+#define LZ77_LEVEL_MIN 1
+#define LZ77_LEVEL_MAX 9
+#define LZ77_LEVEL_DEFAULT 5
+
+void *lz77_context_new(int max_level);
+
+void lz77_context_reset(void *ctx);
+
+void lz77_context_set_stats(void *ctx, Stats *stats);
+
+int lz77_context_set_level(void *ctx, int level);
+
+void lz77_context_free(void *ctx);
+
+size_t lz77_context_size(int max_level);
+
+int lz77_context_set_dict(void *ctx, const String *dict);
 
 void *lz77_deserialize(FILE *stream);
 
-void *lz77_compress(const String *input);
+int lz77_compress(void *ctx, const String *input, String *out);
 
-String *lz77_decompress(const void *compressed);
+int lz77_decode(void *ctx, const uint8_t *src, size_t length, String *out);
 
 void lz77_print(const void *compressed, FILE *stream);
 
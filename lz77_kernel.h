@@ -0,0 +1,286 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+// No include guard: lz77.c includes this once per kernel, after defining LZ77_KERNEL_NAME and
+// one of
+//   LZ77_KERNEL_HASH_BYTES, LZ77_KERNEL_HASH_BITS, LZ77_KERNEL_WINDOW
+//            a match finder for these parameters, with the masks, shifts and bounds folded in
+//   LZ77_KERNEL_GENERIC
+//            a match finder reading them from ctx->params, for any other configuration
+//   LZ77_KERNEL_DICT (0 or 1)
+//            a decoder for blocks without or with a dictionary
+// Every parameter is undefined again at the end.
+
+#define LZ77_KERNEL_CONCAT_(a, b) a##_##b
+#define LZ77_KERNEL_CONCAT(a, b) LZ77_KERNEL_CONCAT_(a, b)
+#define LZ77_KERNEL_FN(fn) LZ77_KERNEL_CONCAT(fn, LZ77_KERNEL_NAME)
+
+#if defined(LZ77_KERNEL_HASH_BYTES) || defined(LZ77_KERNEL_GENERIC)
+
+#ifdef LZ77_KERNEL_GENERIC
+#define LZ77_KERNEL_HASH_BYTES (ctx->params.hash_bytes)
+#define LZ77_KERNEL_HASH_BITS (ctx->params.hash_bits)
+#define LZ77_KERNEL_WINDOW (ctx->params.window)
+#endif
+
+// Up to 4 bytes hash as a 32-bit product, as they always have; 5 need 64 bits.
+uint32_t LZ77_KERNEL_FN(lz77_hash)(const LZ77_Context *ctx, const uint8_t *data) {
+    (void)ctx;
+    uint64_t value = 0;
+    for (unsigned i = 0; i < LZ77_KERNEL_HASH_BYTES; ++i) {
+        value |= (uint64_t)data[i] << (8 * i);
+    }
+    if (LZ77_KERNEL_HASH_BYTES <= 4) {
+        return ((uint32_t)value * 2654435761u) >> (32 - LZ77_KERNEL_HASH_BITS);
+    }
+    return (value * 0x9E3779B97F4A7C15ull) >> (64 - LZ77_KERNEL_HASH_BITS);
+}
+
+void LZ77_KERNEL_FN(lz77_insert)(LZ77_Context *ctx, const uint8_t *data, size_t length, size_t pos) {
+    if (pos + LZ77_KERNEL_HASH_BYTES > length) {
+        return;
+    }
+    uint32_t hash = LZ77_KERNEL_FN(lz77_hash)(ctx, data + pos);
+    uint32_t abs = pos + 1;
+    ctx->prev[abs & ctx->prev_mask] = lz77_head(ctx, hash);
+    ctx->head[hash] = abs;
+    ctx->head_stamp[hash] = ctx->stamp;
+}
+
+// Tries the repeated offsets first: they are cheaper to encode, and a full-length match at
+// one of them skips the hash chain entirely. Sets `*rep` to the repeat index used, or -1.
+size_t LZ77_KERNEL_FN(lz77_find_match)(const LZ77_Context *ctx, const uint8_t *data, size_t length, size_t pos, size_t *offset, int *rep) {
+    *rep = -1;
+    if (pos + LZ77_MIN_MATCH > length) {
+        return 0;
+    }
+    size_t max_length = length - pos;
+    if (max_length > LZ77_MAX_MATCH) {
+        max_length = LZ77_MAX_MATCH;
+    }
+
+    size_t rep_length = 0;
+    int rep_index = -1;
+    for (int i = 0; i < LZ77_REP_COUNT; ++i) {
+        size_t distance = ctx->reps[i];
+        if (distance > pos) {
+            continue;
+        }
+        size_t length = lz77_match_length(data + pos - distance, data + pos, max_length);
+        if (length > rep_length) {
+            rep_length = length;
+            rep_index = i;
+        }
+    }
+    if (rep_length == max_length) {
+        if (ctx->stats) {
+            ctx->stats->chain_searches += 1;
+        }
+        *offset = ctx->reps[rep_index];
+        *rep = rep_index;
+        return rep_length;
+    }
+
+    size_t best_length = 0;
+    size_t best_offset = 0;
+    size_t depth = 0;
+    if (pos + LZ77_KERNEL_HASH_BYTES <= length) {
+        uint32_t abs = pos + 1;
+        uint32_t candidate = lz77_head(ctx, LZ77_KERNEL_FN(lz77_hash)(ctx, data + pos));
+        size_t chain = ctx->params.chain;
+        for (; depth < chain; ++depth) {
+            if (candidate == 0 || candidate >= abs || abs - candidate > LZ77_KERNEL_WINDOW) {
+                break;
+            }
+            size_t length = lz77_match_length(data + candidate - 1, data + pos, max_length);
+            if (length > best_length) {
+                best_length = length;
+                best_offset = abs - candidate;
+                if (length == max_length) {
+                    break;
+                }
+            }
+            uint32_t next = ctx->prev[candidate & ctx->prev_mask];
+            if (next >= candidate) {
+                break;
+            }
+            candidate = next;
+        }
+    }
+    if (ctx->stats) {
+        ctx->stats->chain_searches += 1;
+        ctx->stats->chain_steps += depth;
+    }
+
+    if (rep_length >= LZ77_MIN_MATCH && (rep_length + 1 >= best_length || best_length < LZ77_MIN_OFFSET_MATCH)) {
+        *offset = ctx->reps[rep_index];
+        *rep = rep_index;
+        return rep_length;
+    }
+    if (best_length < LZ77_MIN_OFFSET_MATCH) {
+        return 0;
+    }
+    *rep = lz77_reps_find(ctx->reps, best_offset);
+    *offset = best_offset;
+    return best_length;
+}
+
+// Splits data[start, length) into sequences, leaving them in the context's stream buffers.
+int LZ77_KERNEL_FN(lz77_parse)(LZ77_Context *ctx, const uint8_t *data, size_t start, size_t length) {
+    size_t literal_start = start;
+    for (size_t lookahead = start; lookahead < length;) {
+        if (lookahead > 0 && data[lookahead] == data[lookahead - 1]) {
+            size_t run = byte_run_length(data + lookahead - 1, length - lookahead + 1) - 1;
+            if (run >= LZ77_RUN_MIN_LENGTH) {
+                size_t run_start = lookahead;
+                if (lz77_compress_run(ctx, data, literal_start, &lookahead, run) < 0) {
+                    return -1;
+                }
+                // Only the positions within a match length of the end are hashed: a later
+                // match into the run finds the same bytes there.
+                size_t i = lookahead - run_start > LZ77_MAX_MATCH ? lookahead - LZ77_MAX_MATCH : run_start;
+                for (; i < lookahead; ++i) {
+                    LZ77_KERNEL_FN(lz77_insert)(ctx, data, length, i);
+                }
+                literal_start = lookahead;
+                continue;
+            }
+        }
+
+        size_t match_offset = 0;
+        int rep = -1;
+        size_t match_length = LZ77_KERNEL_FN(lz77_find_match)(ctx, data, length, lookahead, &match_offset, &rep);
+        if (match_length == 0) {
+            if (ctx->stats) {
+                stats_match(ctx->stats, 0, 0);
+            }
+            LZ77_KERNEL_FN(lz77_insert)(ctx, data, length, lookahead);
+            lookahead += 1;
+            continue;
+        }
+
+        size_t run = lookahead - literal_start;
+        if (lz77_emit(ctx, data + literal_start, run, match_length, match_offset, rep) < 0) {
+            return -1;
+        }
+        lz77_reps_update(ctx->reps, rep, match_offset);
+        if (ctx->stats) {
+            stats_match(ctx->stats, match_length, match_offset);
+            if (rep >= 0) {
+                ctx->stats->rep_matches += 1;
+            }
+        }
+        for (size_t end = lookahead + match_length; lookahead < end; ++lookahead) {
+            LZ77_KERNEL_FN(lz77_insert)(ctx, data, length, lookahead);
+        }
+        literal_start = lookahead;
+    }
+    if (literal_start < length && lz77_emit(ctx, data + literal_start, length - literal_start, 0, 0, -1) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+const LZ77_Kernel LZ77_KERNEL_FN(lz77_kernel) = {
+#ifndef LZ77_KERNEL_GENERIC
+    .hash_bytes = LZ77_KERNEL_HASH_BYTES,
+    .hash_bits = LZ77_KERNEL_HASH_BITS,
+    .window = LZ77_KERNEL_WINDOW,
+#endif
+    .hash = LZ77_KERNEL_FN(lz77_hash),
+    .parse = LZ77_KERNEL_FN(lz77_parse),
+};
+
+#undef LZ77_KERNEL_GENERIC
+#undef LZ77_KERNEL_HASH_BYTES
+#undef LZ77_KERNEL_HASH_BITS
+#undef LZ77_KERNEL_WINDOW
+
+#endif // LZ77_KERNEL_HASH_BYTES || LZ77_KERNEL_GENERIC
+
+#ifdef LZ77_KERNEL_DICT
+
+// Decodes the sequences of `streams` straight into `out`, within the room the caller reserved
+// (it is never grown). Each sequence is validated once up front: its run against the literals
+// left, its whole length against the room left and its offset against the output so far.
+// The copies that follow then run without checks, in fixed-size pieces that may write up to
+// LZ77_WILD_COPY bytes past their end while there is room for that; near the end of the
+// buffer they fall back to exact copies. Without a dictionary, an offset can only reach back
+// into the block, so the dictionary bounds and copies drop out.
+int LZ77_KERNEL_FN(lz77_decode)(const LZ77_Context *ctx, LZ77_Streams *streams, String *out, size_t *tokens) {
+    const uint8_t *dict = ctx->window->data;
+    size_t dict_length = LZ77_KERNEL_DICT ? ctx->dict_length : 0;
+    size_t reps[LZ77_REP_COUNT];
+    lz77_reps_init(reps);
+    uint8_t *data = out->data;
+    size_t pos = out->length;
+    size_t limit = out->capacity - 1;
+    for (size_t i = 0; i < streams->sequences; ++i) {
+        size_t run, match_length, offset;
+        int rep;
+        if (lz77_streams_next(streams, &run, &match_length, &offset, &rep) < 0 ||
+            run > (size_t)(streams->literals_end - streams->literals) || run + match_length > limit - pos) {
+            return -1;
+        }
+        if (match_length > 0) {
+            if (rep >= 0) {
+                offset = reps[rep];
+            }
+            if (offset == 0 || offset > pos + run + dict_length) {
+                return -1;
+            }
+            lz77_reps_update(reps, rep, offset);
+        }
+
+        const uint8_t *literals = streams->literals;
+        if (run <= LZ77_WILD_COPY && limit - pos >= LZ77_WILD_COPY &&
+            streams->literals_end - literals >= LZ77_WILD_COPY) {
+            memcpy(data + pos, literals, LZ77_WILD_COPY);
+        } else {
+            memcpy(data + pos, literals, run);
+        }
+        streams->literals += run;
+        pos += run;
+        *tokens += run;
+        if (match_length == 0) {
+            continue;
+        }
+
+        uint8_t *dst = data + pos;
+        if (LZ77_KERNEL_DICT && offset > pos) {
+            // Starts in the dictionary and may run on into the block.
+            size_t from_dict = offset - pos < match_length ? offset - pos : match_length;
+            memcpy(dst, dict + dict_length - (offset - pos), from_dict);
+            for (size_t j = from_dict; j < match_length; ++j) {
+                dst[j] = dst[j - offset];
+            }
+        } else if (offset >= LZ77_WILD_COPY && limit - pos >= match_length + LZ77_WILD_COPY) {
+            // Each piece only reads bytes written before it, so overlapping matches work too.
+            for (size_t j = 0; j < match_length; j += LZ77_WILD_COPY) {
+                memcpy(dst + j, dst + j - offset, LZ77_WILD_COPY);
+            }
+        } else if (offset >= match_length) {
+            memcpy(dst, dst - offset, match_length);
+        } else if (offset == 1) {
+            memset(dst, dst[-1], match_length);
+        } else {
+            for (size_t j = 0; j < match_length; ++j) {
+                dst[j] = dst[j - offset];
+            }
+        }
+        pos += match_length;
+        *tokens += 1;
+    }
+    data[pos] = '\0';
+    out->length = pos;
+    return 0;
+}
+
+#undef LZ77_KERNEL_DICT
+
+#endif // LZ77_KERNEL_DICT
+
+#undef LZ77_KERNEL_NAME
+#undef LZ77_KERNEL_FN
+#undef LZ77_KERNEL_CONCAT
+#undef LZ77_KERNEL_CONCAT_
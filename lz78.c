@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "lz.h"
+#include "mem.h"
 #include "string.h"
 
 typedef struct {
@@ -14,89 +15,148 @@ typedef struct {
     uint8_t symbol;
 } LZ78_Tuple;
 
-typedef struct LZ78_Node {
-    LZ78_Tuple tuple;
-    struct LZ78_Node *parent;
-    struct LZ78_Node *child;
-    struct LZ78_Node *sibling;
+// Nodes live in a fixed pool indexed by their phrase index, so links can be 16-bit indices and
+// node 0 (the root) doubles as the "none" value. Nodes below `primed` come from the dictionary
+// and never change: phrases added on top of them hang off `extra`, which is only live while
+// the node's stamp matches the context's, so a reset just drops back to the primed state.
+typedef struct {
+    uint32_t stamp;
+    uint16_t parent;
+    uint16_t child;
+    uint16_t extra;
+    uint16_t sibling;
+    // The phrase's length, so the decoder knows its room before walking up to the root.
+    uint16_t depth;
+    uint8_t symbol;
 } LZ78_Node;
 
+#define LZ78_MAX_NODES (UINT16_MAX + 1)
+#define LZ78_MAX_PRIMED_NODES (LZ78_MAX_NODES / 4 * 3)
+
+typedef struct {
+    Stats *stats;
+    uint32_t stamp;
+    size_t primed;
+    size_t length;
+    LZ78_Node nodes[LZ78_MAX_NODES];
+} LZ78_Context;
+
 typedef struct {
     size_t capacity;
     size_t length;
     LZ78_Tuple data[];
 } LZ78_TupleList;
 
-LZ78_Node *lz78_node_new(uint16_t index, uint8_t symbol) {
-    LZ78_Node *node = malloc(sizeof(LZ78_Node));
-    if (!node) {
+void *lz78_context_new(void) {
+    LZ78_Context *ctx = mem_map(sizeof(LZ78_Context));
+    if (!ctx) {
         return NULL;
     }
-    node->tuple = (LZ78_Tuple){.index = index, .symbol = symbol};
-    node->parent = NULL;
-    node->child = NULL;
-    node->sibling = NULL;
-    return node;
+    ctx->nodes[0] = (LZ78_Node){0};
+    ctx->stats = NULL;
+    ctx->stamp = 0;
+    ctx->primed = 1;
+    lz78_context_reset(ctx);
+    return ctx;
 }
 
-void lz78_node_free(LZ78_Node *root) {
-    LZ78_Node *node = root->child;
-    while (node) {
-        LZ78_Node *tmp = node;
-        node = node->sibling;
-        lz78_node_free(tmp);
+void lz78_context_reset(void *ctx_) {
+    LZ78_Context *ctx = ctx_;
+    if (ctx->stamp == UINT32_MAX) {
+        for (size_t i = 0; i < ctx->primed; ++i) {
+            ctx->nodes[i].stamp = 0;
+        }
+        ctx->stamp = 0;
     }
-    free(root);
+    ctx->stamp += 1;
+    ctx->length = ctx->primed;
 }
 
-LZ78_Node *lz78_node_find_child(LZ78_Node *parent, uint8_t symbol) {
-    if (!parent->child) {
-        return NULL;
-    }
-    LZ78_Node *child = parent->child;
+void lz78_context_set_stats(void *ctx_, Stats *stats) {
+    LZ78_Context *ctx = ctx_;
+    ctx->stats = stats;
+}
+
+void lz78_context_free(void *ctx) {
+    mem_unmap(ctx, sizeof(LZ78_Context));
+}
+
+size_t lz78_context_size(void) {
+    return sizeof(LZ78_Context);
+}
+
+uint16_t lz78_node_find_child(const LZ78_Context *ctx, uint16_t parent, uint8_t symbol) {
+    const LZ78_Node *node = &ctx->nodes[parent];
+    uint16_t child = parent >= ctx->primed ? node->child : node->stamp == ctx->stamp ? node->extra : 0;
     while (child) {
-        if (child->tuple.symbol == symbol) {
+        if (ctx->nodes[child].symbol == symbol) {
             return child;
         }
-        child = child->sibling;
+        child = ctx->nodes[child].sibling;
     }
-    return NULL;
-}
-
-LZ78_Node *lz78_node_find_traverse(LZ78_Node *node, uint16_t index) {
-    if (!node) {
-        return NULL;
+    if (parent >= ctx->primed) {
+        return 0;
     }
-    if (node->tuple.index == index) {
-        return node;
+    for (child = node->child; child; child = ctx->nodes[child].sibling) {
+        if (ctx->nodes[child].symbol == symbol) {
+            return child;
+        }
     }
-    LZ78_Node *child = lz78_node_find_traverse(node->child, index);
-    if (child) {
-        return child;
+    return 0;
+}
+
+// Adds a phrase as a child of `parent`. Once the 16-bit index space is used up the dictionary
+// starts over, which the decoder mirrors because it adds exactly one node per tuple as well.
+void lz78_node_push(LZ78_Context *ctx, uint16_t parent, uint8_t symbol) {
+    uint16_t index = ctx->length++;
+    LZ78_Node *node = &ctx->nodes[parent];
+    ctx->nodes[index] = (LZ78_Node){.parent = parent, .depth = node->depth + 1, .symbol = symbol};
+    if (parent >= ctx->primed) {
+        ctx->nodes[index].sibling = node->child;
+        node->child = index;
+    } else {
+        ctx->nodes[index].sibling = node->stamp == ctx->stamp ? node->extra : 0;
+        node->extra = index;
+        node->stamp = ctx->stamp;
     }
-    LZ78_Node *sibling = lz78_node_find_traverse(node->sibling, index);
-    if (sibling) {
-        return sibling;
+    if (ctx->length == LZ78_MAX_NODES) {
+        if (ctx->stats) {
+            stats_dict(ctx->stats, ctx->length, LZ78_MAX_NODES, ctx->length, LZ78_MAX_NODES);
+            ctx->stats->dict_resets += 1;
+        }
+        lz78_context_reset(ctx);
     }
-    return NULL;
 }
 
-void lz78_node_push(LZ78_Node *parent, LZ78_Node *child) {
-    if (!parent->child) {
-        parent->child = child;
-        child->parent = parent;
-    } else {
-        LZ78_Node *node = parent->child;
-        while (node->sibling) {
-            node = node->sibling;
+// Builds the phrases of `dict` into the trie the same way compression would, without
+// emitting tuples, and keeps them across resets.
+int lz78_context_set_dict(void *ctx_, const String *dict) {
+    LZ78_Context *ctx = ctx_;
+    ctx->nodes[0] = (LZ78_Node){0};
+    ctx->primed = 0;
+    ctx->length = 1;
+    uint16_t last_match_node = 0;
+    for (size_t i = 0; i < dict->length && ctx->length < LZ78_MAX_PRIMED_NODES; ++i) {
+        const uint8_t symbol = dict->data[i];
+        uint16_t node = lz78_node_find_child(ctx, last_match_node, symbol);
+        if (node) {
+            last_match_node = node;
+        } else {
+            lz78_node_push(ctx, last_match_node, symbol);
+            last_match_node = 0;
         }
-        node->sibling = child;
-        child->parent = node->parent;
     }
+    ctx->primed = ctx->length;
+    for (size_t i = 0; i < ctx->primed; ++i) {
+        ctx->nodes[i].stamp = 0;
+    }
+    ctx->stamp = 0;
+    lz78_context_reset(ctx);
+    return 0;
 }
 
 LZ78_TupleList *lz78_tuple_list_new(size_t capacity) {
-    LZ78_TupleList *list = malloc(sizeof(LZ78_TupleList) + sizeof(LZ78_Tuple) * capacity);
+    LZ78_TupleList *list = mem_alloc(sizeof(LZ78_TupleList) + sizeof(LZ78_Tuple) * capacity);
     if (!list) {
         return NULL;
     }
@@ -106,6 +166,17 @@ LZ78_TupleList *lz78_tuple_list_new(size_t capacity) {
     return list;
 }
 
+// Doubles the list's capacity. On failure the original list is left untouched.
+LZ78_TupleList *lz78_tuple_list_grow(LZ78_TupleList *list) {
+    size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+    LZ78_TupleList *grown = mem_realloc(list, sizeof(LZ78_TupleList) + sizeof(LZ78_Tuple) * capacity);
+    if (!grown) {
+        return NULL;
+    }
+    grown->capacity = capacity;
+    return grown;
+}
+
 int lz78_tuple_list_push(LZ78_TupleList *list, const LZ78_Tuple *tuple) {
     if (list->length >= list->capacity) {
         return -1;
@@ -114,30 +185,12 @@ int lz78_tuple_list_push(LZ78_TupleList *list, const LZ78_Tuple *tuple) {
     return 0;
 }
 
-int lz78_serialize(const void *compressed, FILE *stream) {
-    const LZ78_TupleList *list = compressed;
-    for (size_t i = 0; i < list->length; ++i) {
-        const LZ78_Tuple *tuple = &list->data[i];
-        uint8_t buf[3];
-        uint16_be_write(buf, tuple->index);
-        uint8_be_write(buf + 2, tuple->symbol);
-        size_t written = fwrite(buf, 1, sizeof(buf), stream);
-        if (written != sizeof(buf)) {
-            return -1;
-        }
-    }
-    return 0;
-}
-
 void *lz78_deserialize(FILE *stream) {
     bool error = false;
     LZ78_TupleList *list = NULL;
 
-    fseek(stream, 0, SEEK_END);
-    long file_size = ftell(stream);
-    rewind(stream);
-
-    list = lz78_tuple_list_new(file_size);
+    // The stream may be a pipe, so its size is unknown up front and the list grows as it fills.
+    list = lz78_tuple_list_new(64);
     if (!list) {
         error = true;
         goto cleanup;
@@ -147,12 +200,20 @@ void *lz78_deserialize(FILE *stream) {
         uint8_t buf[3];
         size_t read = fread(buf, 1, sizeof(buf), stream);
         if (read != sizeof(buf)) {
-            if (feof(stream)) {
+            if (read == 0 && feof(stream)) {
                 break;
             }
             error = true;
             goto cleanup;
         }
+        if (list->length == list->capacity) {
+            LZ78_TupleList *grown = lz78_tuple_list_grow(list);
+            if (!grown) {
+                error = true;
+                goto cleanup;
+            }
+            list = grown;
+        }
         LZ78_Tuple tuple = {
             .index = uint16_be_read(buf),
             .symbol = uint8_be_read(buf + 2),
@@ -165,141 +226,116 @@ void *lz78_deserialize(FILE *stream) {
 
     cleanup:
     if (error) {
-        free(list);
+        mem_free(list);
         return NULL;
     }
     return list;
 }
 
-void *lz78_compress(const String *input) {
-    bool error = false;
-    LZ78_Node *root = NULL;
-    LZ78_TupleList *list = NULL;
-
-    list = lz78_tuple_list_new(input->length);
-    if (!list) {
-        error = true;
-        goto cleanup;
+// Writes a tuple in its serialized form: a 16-bit phrase index followed by the symbol.
+int lz78_emit(String *out, uint16_t index, uint8_t symbol) {
+    if (string_grow(out, 3) < 0) {
+        return -1;
     }
+    uint8_t *buf = out->data + out->length;
+    uint16_be_write(buf, index);
+    uint8_be_write(buf + 2, symbol);
+    out->length += 3;
+    return 0;
+}
 
-    root = lz78_node_new(0, '\0');
-    if (!root) {
-        error = true;
-        goto cleanup;
-    }
+// Tuples are written to `out` as the trie walk produces them rather than collected first.
+int lz78_compress(void *ctx_, const String *input, String *out) {
+    LZ78_Context *ctx = ctx_;
+    bool error = false;
+
+    lz78_context_reset(ctx);
 
-    size_t next_index = 1;
-    LZ78_Node *last_match_node = root;
-    for (size_t i = 0; i <= input->length; ++i) {
-        const char symbol = i == input->length ? '\0' : input->data[i];
-        LZ78_Node *node = lz78_node_find_child(last_match_node, symbol);
+    uint16_t last_match_node = 0;
+    size_t match_length = 0;
+    for (size_t i = 0; i < input->length; ++i) {
+        const uint8_t symbol = input->data[i];
+        uint16_t node = lz78_node_find_child(ctx, last_match_node, symbol);
         if (node) {
             last_match_node = node;
+            match_length += 1;
         } else {
-            size_t index = next_index++;
-            LZ78_Node *child = lz78_node_new(index, symbol);
-            lz78_node_push(last_match_node, child);
-            LZ78_Tuple tuple = {.index = last_match_node->tuple.index, .symbol = symbol};
-            if (lz78_tuple_list_push(list, &tuple) < 0) {
+            if (lz78_emit(out, last_match_node, symbol) < 0) {
                 error = true;
                 goto cleanup;
             }
-            last_match_node = root;
+            if (ctx->stats) {
+                stats_match(ctx->stats, match_length, 0);
+            }
+            lz78_node_push(ctx, last_match_node, symbol);
+            last_match_node = 0;
+            match_length = 0;
         }
     }
-
-cleanup:
-    lz78_node_free(root);
-    if (error) {
-        lz78_free(list);
-        return NULL;
+    // The final tuple carries the trailing phrase (if any) and no symbol; its symbol byte is 0.
+    if (lz78_emit(out, last_match_node, 0) < 0) {
+        error = true;
+        goto cleanup;
     }
-    return list;
-}
-
-int lz78_tuple_list_resolve(String *out, LZ78_Node *node) {
-    while (node && node->tuple.symbol != '\0') {
-        if (string_push(out, node->tuple.symbol) < 0) {
-            return -1;
-        }
-        node = node->parent;
+    if (ctx->stats) {
+        stats_match(ctx->stats, match_length, 0);
+        stats_dict(ctx->stats, ctx->length, LZ78_MAX_NODES, ctx->length, LZ78_MAX_NODES);
     }
-    return 0;
-}
 
-String *lz78_decompress(const void *compressed) {
-    const LZ78_TupleList *list = compressed;
-    bool error = false;
-    String *buf = NULL;
-    LZ78_Node *root = NULL;
+cleanup:
+    return error ? -1 : 0;
+}
 
-    buf = string_new();
-    if (!buf) {
-        error = true;
-        goto cleanup;
+// Decodes a serialized tuple stream straight into `out`, growing the trie as it goes, within
+// the room the caller reserved. A phrase's length is known from its node, so its room is
+// checked once and the walk up to the root then writes it backwards without checks. Every
+// tuple but the last has a symbol, which may be any byte including 0.
+int lz78_decode(void *ctx_, const uint8_t *src, size_t length, String *out) {
+    LZ78_Context *ctx = ctx_;
+    if (length % 3 != 0) {
+        return -1;
     }
 
-    root = lz78_node_new(0, '\0');
-    if (!root) {
-        error = true;
-        goto cleanup;
+    lz78_context_reset(ctx);
+    if (ctx->stats) {
+        ctx->stats->tokens += length / 3;
     }
 
-    size_t next_index = 1;
-    for (size_t i = 0; i < list->length; ++i) {
-        const LZ78_Tuple *tuple = &list->data[i];
-        LZ78_Node *node = root;
-        if (tuple->index != 0) {
-            node = lz78_node_find_traverse(root, tuple->index);
-            if (!node) {
-                error = true;
-                goto cleanup;
-            }
-            String *prefix = string_new();
-            if (!prefix) {
-                error = true;
-                goto cleanup;
-            }
-            if (lz78_tuple_list_resolve(prefix, node) < 0) {
-                error = true;
-                goto cleanup;
-            }
-            for (size_t j = prefix->length; j-- > 0;) {
-                if (string_push(buf, prefix->data[j]) < 0) {
-                    error = true;
-                    goto cleanup;
-                }
-            }
-            string_free(prefix);
+    uint8_t *data = out->data;
+    size_t pos = out->length;
+    size_t limit = out->capacity - 1;
+    for (size_t i = 0; i < length; i += 3) {
+        uint16_t index = uint16_be_read(src + i);
+        uint8_t symbol = uint8_be_read(src + i + 2);
+        size_t symbol_length = i + 3 < length;
+        if (index >= ctx->length || ctx->nodes[index].depth + symbol_length > limit - pos ||
+            (symbol_length == 0 && symbol != 0)) {
+            return -1;
         }
-        if (tuple->symbol != '\0') {
-            if (string_push(buf, tuple->symbol) < 0) {
-                error = true;
-                goto cleanup;
-            }
+        pos += ctx->nodes[index].depth;
+        uint8_t *p = data + pos;
+        for (uint16_t node = index; node; node = ctx->nodes[node].parent) {
+            *--p = ctx->nodes[node].symbol;
         }
-        LZ78_Node *child = lz78_node_new(next_index++, tuple->symbol);
-        lz78_node_push(node, child);
+        data[pos] = symbol;
+        pos += symbol_length;
+        lz78_node_push(ctx, index, symbol);
     }
-
-cleanup:
-    lz78_node_free(root);
-    if (error) {
-        string_free(buf);
-        return NULL;
-    }
-    return buf;
+    data[pos] = '\0';
+    out->length = pos;
+    return 0;
 }
 
 void lz78_print(const void *compressed, FILE *stream) {
     const LZ78_TupleList *list = compressed;
     for (size_t i = 0; i < list->length; ++i) {
         const LZ78_Tuple *tuple = &list->data[i];
-        fprintf(stream, "(%d, '%s')\n", tuple->index, escape_char(tuple->symbol));
+        char escaped[ESCAPE_CHAR_BUF_SIZE];
+        fprintf(stream, "(%d, '%s')\n", tuple->index, escape_char(tuple->symbol, escaped));
     }
 }
 
 void lz78_free(void *compressed) {
-    free(compressed);
+    mem_free(compressed);
 }
 
@@ -7,15 +7,26 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "stats.h"
 #include "string.h"
 
-int lz78_serialize(const void *compressed, FILE *stream);
+void *lz78_context_new(void);
+
+void lz78_context_reset(void *ctx);
+
+void lz78_context_set_stats(void *ctx, Stats *stats);
+
+void lz78_context_free(void *ctx);
+
+size_t lz78_context_size(void);
+
+int lz78_context_set_dict(void *ctx, const String *dict);
 
 void *lz78_deserialize(FILE *stream);
 
-void *lz78_compress(const String *input);
+int lz78_compress(void *ctx, const String *input, String *out);
 
-String *lz78_decompress(const void *compressed);
+int lz78_decode(void *ctx, const uint8_t *src, size_t length, String *out);
 
 void lz78_print(const void *compressed, FILE *stream);
 
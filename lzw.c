@@ -1,7 +1,6 @@
 /* SPDX-License-Identifier: MIT */
 /* Copyright (c) 2025 Saleh Zaidan */
 
-#include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -9,18 +8,35 @@
 #include <string.h>
 
 #include "lz.h"
+#include "mem.h"
 #include "string.h"
 
-typedef struct LZW_Entry {
-    String *prefix;
+#define LZW_CODE_BITS 12
+#define LZAP_CODE_BITS 16
+#define LZW_FIRST_CODE (UINT8_MAX + 1)
+#define LZW_NO_CODE UINT16_MAX
+#define LZW_DICT_STAMP 1
+#define LZW_RUN_MIN_LENGTH 16
+
+// Encoder side: maps (prefix code, symbol) to a code. A slot is only live when its stamp
+// matches the context's, so bumping the stamp empties the table without touching it.
+// Slots filled from a dictionary carry LZW_DICT_STAMP and survive every reset.
+typedef struct {
+    uint32_t stamp;
+    uint16_t prefix;
     uint16_t code;
-    struct LZW_Entry *next;
-} LZW_Entry;
+    uint8_t symbol;
+} LZW_Slot;
 
+// Decoder side: every code is its prefix code plus one symbol. LZAP's decoder also keeps
+// where in the block it wrote the sequence, and copies it from there.
 typedef struct {
-    size_t capacity;
-    LZW_Entry *data[];
-} LZW_HashTable;
+    uint32_t offset;
+    uint16_t prefix;
+    uint16_t length;
+    uint8_t symbol;
+    uint8_t first;
+} LZW_Entry;
 
 typedef struct {
     size_t capacity;
@@ -28,117 +44,198 @@ typedef struct {
     uint16_t data[];
 } LZW_CodeList;
 
+// The LZAP decoder's view of the last phrase, `prev`, written at `prev_offset` of the block,
+// and of the `ext_count` codes from `ext_code` on that the extension before it defined.
 typedef struct {
-    size_t capacity;
-    String *data[];
-} LZW_PrefixTable;
+    uint16_t prev;
+    uint32_t prev_offset;
+    uint16_t ext_code;
+    uint32_t ext_count;
+} LZAP_Decoder;
+
+// `run_codes[k]` is the code of `run_symbol` repeated k + 1 times, for the first `run_count`
+// lengths. The dictionary is prefix-closed, so these always form an unbroken chain; the cache
+// holds while `run_stamp` matches the context's. The tables follow the context in the same
+// mapping, sized by `code_bits`: `max_codes` entries and twice as many slots.
+typedef struct {
+    Stats *stats;
+    bool lzap;
+    unsigned code_bits;
+    uint32_t max_codes;
+    size_t hash_size;
+    uint32_t stamp;
+    uint32_t first_code;
+    uint32_t next_code;
+    uint32_t run_stamp;
+    uint16_t run_count;
+    uint8_t run_symbol;
+    LZW_Slot *slots;
+    LZW_Entry *entries;
+    uint16_t *run_codes;
+} LZW_Context;
+
+size_t lzw_context_size_for(unsigned code_bits) {
+    size_t codes = (size_t)1 << code_bits;
+    return sizeof(LZW_Context) + 2 * codes * sizeof(LZW_Slot) + codes * sizeof(LZW_Entry) + codes * sizeof(uint16_t);
+}
 
-LZW_Entry *lzw_entry_new(String *prefix, uint16_t code) {
-    LZW_Entry *entry = malloc(sizeof(LZW_Entry));
-    if (!entry) {
+LZW_Context *lzw_context_create(unsigned code_bits) {
+    LZW_Context *ctx = mem_map(lzw_context_size_for(code_bits));
+    if (!ctx) {
         return NULL;
     }
-    entry->prefix = prefix;
-    entry->code = code;
-    entry->next = NULL;
-    return entry;
+    size_t codes = (size_t)1 << code_bits;
+    ctx->code_bits = code_bits;
+    // LZW_NO_CODE is never a code, which only matters with 16 bits.
+    ctx->max_codes = codes < LZW_NO_CODE ? codes : LZW_NO_CODE;
+    ctx->hash_size = 2 * codes;
+    ctx->slots = (LZW_Slot *)(ctx + 1);
+    ctx->entries = (LZW_Entry *)(ctx->slots + ctx->hash_size);
+    ctx->run_codes = (uint16_t *)(ctx->entries + codes);
+    // The mapping starts zeroed, so every slot is empty.
+    for (int ch = 0; ch <= UINT8_MAX; ++ch) {
+        ctx->entries[ch] = (LZW_Entry){.prefix = LZW_NO_CODE, .length = 1, .symbol = ch, .first = ch};
+    }
+    ctx->stats = NULL;
+    ctx->run_stamp = 0;
+    ctx->stamp = LZW_DICT_STAMP;
+    ctx->first_code = LZW_FIRST_CODE;
+    lzw_context_reset(ctx);
+    return ctx;
+}
+
+void *lzw_context_new(void) {
+    return lzw_context_create(LZW_CODE_BITS);
 }
 
-void lzw_entry_free(LZW_Entry *entry) {
-    if (entry->next) {
-        lzw_entry_free(entry->next);
+// LZAP: after each phrase, the previous phrase followed by every prefix of it is added, not
+// just by its first symbol, so long repeats are learnt in a few phrases instead of one symbol
+// at a time. That fills the dictionary much faster, so it has 16-bit codes, written as they
+// are; everything else is shared with LZW.
+void *lzap_context_new(void) {
+    LZW_Context *ctx = lzw_context_create(LZAP_CODE_BITS);
+    if (ctx) {
+        ctx->lzap = true;
     }
-    string_free(entry->prefix);
-    free(entry);
+    return ctx;
 }
 
-void lzw_entry_print(const LZW_Entry *entry, FILE *stream) {
-    fprintf(stream, "(prefix: ");
-    for (size_t i = 0; i < entry->prefix->length; ++i) {
-        char ch = entry->prefix->data[i];
-        if (isprint(ch)) {
-            fputc(ch, stream);
-        } else {
-            fprintf(stream, "<%d>", ch);
+void lzw_context_reset(void *ctx_) {
+    LZW_Context *ctx = ctx_;
+    if (ctx->stamp == UINT32_MAX) {
+        for (size_t i = 0; i < ctx->hash_size; ++i) {
+            if (ctx->slots[i].stamp != LZW_DICT_STAMP) {
+                ctx->slots[i].stamp = 0;
+            }
         }
+        ctx->stamp = LZW_DICT_STAMP;
+        ctx->run_stamp = 0;
     }
-    fprintf(stream, ", code: %hu)", entry->code);
+    ctx->stamp += 1;
+    ctx->next_code = ctx->first_code;
 }
 
-LZW_HashTable *lzw_hash_table_new(size_t capacity) {
-    LZW_HashTable *table = malloc(sizeof(LZW_HashTable) + sizeof(LZW_Entry) * capacity);
-    if (!table) {
-        return NULL;
-    }
-    table->capacity = capacity;
-    memset(table->data, 0, sizeof(LZW_Entry) * capacity);
-    return table;
+void lzw_context_set_stats(void *ctx_, Stats *stats) {
+    LZW_Context *ctx = ctx_;
+    ctx->stats = stats;
 }
 
-void lzw_hash_table_free(LZW_HashTable *table) {
-    for (size_t i = 0; i < table->capacity; ++i) {
-        LZW_Entry *entry = table->data[i];
-        if (entry) {
-            lzw_entry_free(entry);
+void lzw_context_free(void *ctx_) {
+    LZW_Context *ctx = ctx_;
+    mem_unmap(ctx, lzw_context_size_for(ctx->code_bits));
+}
+
+size_t lzw_context_size(void) {
+    return lzw_context_size_for(LZW_CODE_BITS);
+}
+
+size_t lzap_context_size(void) {
+    return lzw_context_size_for(LZAP_CODE_BITS);
+}
+
+size_t lzw_slot_index(const LZW_Context *ctx, uint16_t prefix, uint8_t symbol) {
+    uint32_t key = (uint32_t)prefix << 8 | symbol;
+    return (key * 2654435761u) >> (32 - ctx->code_bits - 1);
+}
+
+bool lzw_slot_live(const LZW_Context *ctx, const LZW_Slot *slot) {
+    return slot->stamp == ctx->stamp || slot->stamp == LZW_DICT_STAMP;
+}
+
+uint16_t lzw_context_get(const LZW_Context *ctx, uint16_t prefix, uint8_t symbol) {
+    for (size_t i = lzw_slot_index(ctx, prefix, symbol);; i = (i + 1) % ctx->hash_size) {
+        const LZW_Slot *slot = &ctx->slots[i];
+        if (!lzw_slot_live(ctx, slot)) {
+            return LZW_NO_CODE;
+        }
+        if (slot->prefix == prefix && slot->symbol == symbol) {
+            return slot->code;
         }
     }
-    free(table);
 }
 
-size_t lzw_hash_table_hash_prefix(const LZW_HashTable *table, const String *prefix) {
-    size_t hash = 5381;
-    for (size_t i = 0; i < prefix->length; ++i) {
-        hash = ((hash << 5) + hash) + prefix->data[i];
+void lzw_context_full(LZW_Context *ctx) {
+    if (ctx->stats) {
+        stats_dict(ctx->stats, ctx->max_codes, ctx->max_codes, ctx->max_codes - LZW_FIRST_CODE, ctx->hash_size);
+        ctx->stats->dict_resets += 1;
     }
-    return hash % table->capacity;
+    lzw_context_reset(ctx);
 }
 
-LZW_Entry *lzw_hash_table_get(const LZW_HashTable *table, const String *prefix) {
-    size_t index = lzw_hash_table_hash_prefix(table, prefix);
-    LZW_Entry *entry = table->data[index];
-    if (!entry) {
-        return NULL;
+// Assigns the next code to (prefix, symbol). When the code space runs out the dictionary
+// starts over; the decoder does the same after the same number of insertions.
+void lzw_context_insert(LZW_Context *ctx, uint16_t prefix, uint8_t symbol) {
+    size_t i = lzw_slot_index(ctx, prefix, symbol);
+    while (lzw_slot_live(ctx, &ctx->slots[i])) {
+        i = (i + 1) % ctx->hash_size;
     }
-    while (entry) {
-        if (entry->prefix->length == prefix->length &&
-            strncmp(entry->prefix->data, prefix->data, prefix->length) == 0) {
-            return entry;
-        }
-        entry = entry->next;
+    ctx->slots[i] = (LZW_Slot){.stamp = ctx->stamp, .prefix = prefix, .code = ctx->next_code, .symbol = symbol};
+    if (++ctx->next_code == ctx->max_codes) {
+        lzw_context_full(ctx);
     }
-    return NULL;
 }
 
-void lzw_hash_table_insert(LZW_HashTable *table, String *prefix, uint16_t code) {
-    size_t index = lzw_hash_table_hash_prefix(table, prefix);
-    LZW_Entry *new_entry = lzw_entry_new(prefix, code);
-    LZW_Entry *entry = table->data[index];
-    if (!entry) {
-        table->data[index] = new_entry;
-        return;
-    }
-    while (entry->next) {
-        entry = entry->next;
-    }
-    entry->next = new_entry;
+void lzw_context_define(LZW_Context *ctx, uint16_t code, uint16_t prefix, uint8_t symbol) {
+    ctx->entries[code] = (LZW_Entry){
+        .prefix = prefix,
+        .length = ctx->entries[prefix].length + 1,
+        .symbol = symbol,
+        .first = ctx->entries[prefix].first,
+    };
 }
 
-void lzw_hash_table_pprint(const LZW_HashTable *table, FILE *stream) {
-    for (size_t i = 0; i < table->capacity; ++i) {
-        LZW_Entry *entry = table->data[i];
-        while (entry) {
-            lzw_entry_print(entry, stream);
-            if (entry->next) {
-                fprintf(stream, " -> ");
-            }
-            entry = entry->next;
+// Runs the encoder's dictionary building over `dict` and keeps the resulting codes, on both
+// the encoder and decoder side, as the starting point of every reset.
+int lzw_context_set_dict(void *ctx_, const String *dict) {
+    LZW_Context *ctx = ctx_;
+    memset(ctx->slots, 0, ctx->hash_size * sizeof(LZW_Slot));
+    ctx->stamp = LZW_DICT_STAMP;
+    ctx->run_stamp = 0;
+    ctx->next_code = LZW_FIRST_CODE;
+    uint16_t seq = LZW_NO_CODE;
+    // A quarter of the codes is left for the input itself.
+    for (size_t i = 0; i < dict->length && ctx->next_code < ctx->max_codes / 4 * 3; ++i) {
+        const uint8_t symbol = dict->data[i];
+        if (seq == LZW_NO_CODE) {
+            seq = symbol;
+            continue;
+        }
+        uint16_t candidate = lzw_context_get(ctx, seq, symbol);
+        if (candidate != LZW_NO_CODE) {
+            seq = candidate;
+        } else {
+            lzw_context_define(ctx, ctx->next_code, seq, symbol);
+            lzw_context_insert(ctx, seq, symbol);
+            seq = symbol;
         }
-        fputc('\n', stream);
     }
+    ctx->first_code = ctx->next_code;
+    lzw_context_reset(ctx);
+    return 0;
 }
 
 LZW_CodeList *lzw_code_list_new(size_t capacity) {
-    LZW_CodeList *list = malloc(sizeof(LZW_CodeList) + sizeof(uint16_t) * capacity);
+    LZW_CodeList *list = mem_alloc(sizeof(LZW_CodeList) + sizeof(uint16_t) * capacity);
     if (!list) {
         return NULL;
     }
@@ -149,46 +246,25 @@ LZW_CodeList *lzw_code_list_new(size_t capacity) {
 }
 
 void lzw_code_list_free(LZW_CodeList *list) {
-    free(list);
-}
-
-int lzw_code_list_push(LZW_CodeList *list, uint16_t code) {
-    if (list->length >= list->capacity) {
-        return -1;
-    }
-    list->data[list->length++] = code;
-    return 0;
+    mem_free(list);
 }
 
-LZW_PrefixTable *lzw_prefix_table_new(size_t capacity) {
-    LZW_PrefixTable *table = malloc(sizeof(LZW_PrefixTable) + sizeof(String *) * capacity);
-    if (!table) {
+// Doubles the list's capacity. On failure the original list is left untouched.
+LZW_CodeList *lzw_code_list_grow(LZW_CodeList *list) {
+    size_t capacity = list->capacity > 0 ? list->capacity * 2 : 64;
+    LZW_CodeList *grown = mem_realloc(list, sizeof(LZW_CodeList) + sizeof(uint16_t) * capacity);
+    if (!grown) {
         return NULL;
     }
-    table->capacity = capacity;
-    memset(table->data, 0, sizeof(String *) * capacity);
-    return table;
-}
-
-void lzw_prefix_table_free(LZW_PrefixTable *table) {
-    for (size_t i = 0; i < table->capacity; ++i) {
-        String *s = table->data[i];
-        if (s) {
-            string_free(s);
-        }
-    }
-    free(table);
-}
-
-String *lzw_prefix_table_get(LZW_PrefixTable *table, uint16_t code) {
-    return table->data[code];
+    grown->capacity = capacity;
+    return grown;
 }
 
-int lzw_prefix_table_insert(LZW_PrefixTable *table, uint16_t code, String *prefix) {
-    if (code >= table->capacity) {
+int lzw_code_list_push(LZW_CodeList *list, uint16_t code) {
+    if (list->length >= list->capacity) {
         return -1;
     }
-    table->data[code] = prefix;
+    list->data[list->length++] = code;
     return 0;
 }
 
@@ -198,25 +274,7 @@ void codes_to_bytes(uint8_t *buf, uint16_t code1, uint16_t code2) {
     buf[2] = code2 & 0xFF;
 }
 
-int lzw_serialize(const void *compressed, FILE *stream) {
-    const LZW_CodeList *list = compressed;
-    for (size_t i = 0; i < list->length; i += 2) {
-        // WARNING: When the number of codes is odd, the final code pair includes a placeholder value of 0 for code2.
-        // If 0 is a valid LZW code, this may lead to ambiguity during deserialization.
-        // This format is therefore unsafe for binary data where 0 is a legal code.
-        uint16_t code1 = list->data[i];
-        uint16_t code2 = i + 1 >= list->length ? 0 : list->data[i + 1];
-        uint8_t buf[3];
-        codes_to_bytes(buf, code1, code2);
-        size_t written = fwrite(buf, 1, sizeof(buf), stream);
-        if (written != sizeof(buf)) {
-            return -1;
-        }
-    }
-    return 0;
-}
-
-void bytes_to_codes(uint8_t *buf, uint16_t *code1, uint16_t *code2) {
+void bytes_to_codes(const uint8_t *buf, uint16_t *code1, uint16_t *code2) {
     *code1 = (buf[0] << 4) | ((buf[1] >> 4) & 0xF);
     *code2 = ((buf[1] & 0xF) << 8) | buf[2];
 }
@@ -225,21 +283,30 @@ void *lzw_deserialize(FILE *stream) {
     bool error = false;
     LZW_CodeList *list = NULL;
 
-    fseek(stream, 0, SEEK_END);
-    long file_size = ftell(stream);
-    rewind(stream);
-
-    list = lzw_code_list_new(file_size);
+    // The stream may be a pipe, so its size is unknown up front and the list grows as it fills.
+    list = lzw_code_list_new(64);
     if (!list) {
         error = true;
         goto cleanup;
     }
 
     while (true) {
+        if (list->capacity - list->length < 2) {
+            LZW_CodeList *grown = lzw_code_list_grow(list);
+            if (!grown) {
+                error = true;
+                goto cleanup;
+            }
+            list = grown;
+        }
         uint8_t buf[3];
         size_t read = fread(buf, 1, sizeof(buf), stream);
         if (read != sizeof(buf)) {
-            if (feof(stream)) {
+            if (read == 0 && feof(stream)) {
+                break;
+            }
+            // An odd final code is written alone in 2 bytes.
+            if (read == 2 && feof(stream) && lzw_code_list_push(list, uint16_be_read(buf)) == 0) {
                 break;
             }
             error = true;
@@ -251,7 +318,7 @@ void *lzw_deserialize(FILE *stream) {
             error = true;
             goto cleanup;
         }
-        if (code2 != 0 && lzw_code_list_push(list, code2) < 0) {
+        if (lzw_code_list_push(list, code2) < 0) {
             error = true;
             goto cleanup;
         }
@@ -259,194 +326,391 @@ void *lzw_deserialize(FILE *stream) {
 
 cleanup:
     if (error) {
-        free(list);
+        mem_free(list);
         return NULL;
     }
     return list;
 }
 
-void *lzw_compress(const String *input) {
-    bool error = false;
-    LZW_CodeList *list = NULL;
-    LZW_HashTable *dict = NULL;
-    String *seq = NULL;
-
-    list = lzw_code_list_new(input->length);
+// LZAP codes are 16 bits and written as they are, two bytes each.
+void *lzap_deserialize(FILE *stream) {
+    LZW_CodeList *list = lzw_code_list_new(64);
     if (!list) {
-        error = true;
-        goto cleanup;
+        return NULL;
+    }
+    uint8_t buf[2];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), stream)) == sizeof(buf)) {
+        if (list->length == list->capacity) {
+            LZW_CodeList *grown = lzw_code_list_grow(list);
+            if (!grown) {
+                mem_free(list);
+                return NULL;
+            }
+            list = grown;
+        }
+        lzw_code_list_push(list, uint16_be_read(buf));
+    }
+    if (read != 0 || !feof(stream)) {
+        mem_free(list);
+        return NULL;
     }
+    return list;
+}
 
-    dict = lzw_hash_table_new(4096);
-    if (!dict) {
-        error = true;
-        goto cleanup;
+// Codes are written in pairs packed into 3 bytes, so an odd code waits in `pending` for its
+// partner. Passing LZW_NO_CODE flushes a pending code on its own, in 2 bytes: a block's
+// length then tells whether it ends with one, and every pair holds two real codes (0 among
+// them). LZAP codes go out at once.
+int lzw_emit(const LZW_Context *ctx, String *out, uint16_t *pending, uint16_t code) {
+    if (ctx->lzap) {
+        if (string_grow(out, 2) < 0) {
+            return -1;
+        }
+        uint16_be_write(out->data + out->length, code);
+        out->length += 2;
+        return 0;
     }
-    uint16_t next_code = 0;
-    for (int ch = 0; ch <= UINT8_MAX; ++ch) {
-        String *s = string_new();
-        if (!s) {
-            error = true;
-            goto cleanup;
+    if (*pending == LZW_NO_CODE) {
+        *pending = code;
+        return 0;
+    }
+    if (code == LZW_NO_CODE) {
+        if (string_grow(out, 2) < 0) {
+            return -1;
         }
-        if (string_push(s, ch) < 0) {
-            error = true;
-            goto cleanup;
+        uint16_be_write(out->data + out->length, *pending);
+        out->length += 2;
+        *pending = LZW_NO_CODE;
+        return 0;
+    }
+    if (string_grow(out, 3) < 0) {
+        return -1;
+    }
+    codes_to_bytes(out->data + out->length, *pending, code);
+    out->length += 3;
+    *pending = LZW_NO_CODE;
+    return 0;
+}
+
+// Adds `prev` followed by each prefix of `phrase` (of `length` bytes, encoded as `code`) that
+// is not in the dictionary yet. The dictionary stays prefix-closed, so the walk follows the
+// existing part and every code after it is new. The encoder calls this once it has emitted
+// `code`, and the decoder does the same in lzap_decode_extend once it has decoded it, so
+// unlike LZW no code is ever used in the step that defines it. Returns the code the next
+// phrase extends: `code`, or LZW_NO_CODE when the dictionary started over, which leaves
+// `code` meaningless.
+uint16_t lzap_extend(LZW_Context *ctx, uint16_t prev, uint16_t code, const uint8_t *phrase, size_t length) {
+    if (prev == LZW_NO_CODE) {
+        return code;
+    }
+    uint16_t node = prev;
+    // A code added just now has no extensions yet, so the lookups stop at the first miss.
+    bool found = true;
+    for (size_t i = 0; i < length; ++i) {
+        uint16_t next = found ? lzw_context_get(ctx, node, phrase[i]) : LZW_NO_CODE;
+        if (next == LZW_NO_CODE) {
+            found = false;
+            // Entries hold their length in 16 bits; longer ones are left out on both sides.
+            if (ctx->entries[node].length == UINT16_MAX) {
+                break;
+            }
+            next = ctx->next_code;
+            lzw_context_define(ctx, next, node, phrase[i]);
+            lzw_context_insert(ctx, node, phrase[i]);
+            if (ctx->next_code == ctx->first_code) {
+                return LZW_NO_CODE;
+            }
         }
-        lzw_hash_table_insert(dict, s, next_code++);
+        node = next;
     }
+    return code;
+}
 
-    seq = string_new();
-    if (!seq) {
-        error = true;
-        goto cleanup;
+// Returns the code of `symbol` repeated `length` times (which the caller knows to exist up to
+// `length - 1`), or LZW_NO_CODE when it is not in the dictionary.
+uint16_t lzw_run_code(LZW_Context *ctx, uint8_t symbol, size_t length) {
+    if (ctx->run_stamp != ctx->stamp || ctx->run_symbol != symbol) {
+        ctx->run_stamp = ctx->stamp;
+        ctx->run_symbol = symbol;
+        ctx->run_codes[0] = symbol;
+        ctx->run_count = 1;
+    }
+    while (ctx->run_count < length) {
+        uint16_t code = lzw_context_get(ctx, ctx->run_codes[ctx->run_count - 1], symbol);
+        if (code == LZW_NO_CODE) {
+            return LZW_NO_CODE;
+        }
+        ctx->run_codes[ctx->run_count++] = code;
     }
+    return ctx->run_codes[length - 1];
+}
 
-    for (size_t i = 0; i < input->length; ++i) {
-        const char symbol = input->data[i];
-        String *candidate = string_copy(seq);
-        if (!candidate) {
-            error = true;
-            goto cleanup;
+// Encodes the `run` repeats of a byte at the start of a sequence the way the byte-by-byte walk
+// would, but from the cached chain of run codes: the walk takes the longest one that fits,
+// emits it and adds it plus one more repeat. Returns the code left open at the end of the
+// run (the next input byte differs), with its length in `*seq_length`.
+int lzw_compress_run(LZW_Context *ctx, uint8_t symbol, size_t run, String *out, uint16_t *pending, size_t *seq_length) {
+    while (true) {
+        // Makes the cache hold `symbol`; a single repeat is always there.
+        lzw_run_code(ctx, symbol, 1);
+        size_t length = ctx->run_count < run ? ctx->run_count : run;
+        uint16_t code = lzw_run_code(ctx, symbol, length);
+        while (length < run) {
+            uint16_t longer = lzw_run_code(ctx, symbol, length + 1);
+            if (longer == LZW_NO_CODE) {
+                break;
+            }
+            code = longer;
+            length += 1;
         }
-        if (string_push(candidate, symbol) < 0) {
-            error = true;
-            goto cleanup;
+        if (length == run) {
+            *seq_length = length;
+            return code;
         }
+        if (lzw_emit(ctx, out, pending, code) < 0) {
+            return -1;
+        }
+        if (ctx->stats) {
+            stats_match(ctx->stats, length > 1 ? length : 0, 0);
+        }
+        lzw_context_insert(ctx, code, symbol);
+        run -= length;
+    }
+}
 
-        LZW_Entry *candidate_entry = lzw_hash_table_get(dict, candidate);
-        if (candidate_entry) {
-            string_free(seq);
-            seq = candidate;
-        } else {
-            LZW_Entry *seq_entry = lzw_hash_table_get(dict, seq);
-            if (!seq_entry) {
-                error = true;
-                goto cleanup;
-            }
-            if (lzw_code_list_push(list, seq_entry->code) < 0) {
+// Codes are written to `out` as the dictionary walk produces them rather than collected first.
+// A sequence starting a run of one byte takes the run path instead of one lookup per byte;
+// LZAP has none, as its phrases double along a run anyway.
+int lzw_compress(void *ctx_, const String *input, String *out) {
+    LZW_Context *ctx = ctx_;
+    bool error = false;
+
+    lzw_context_reset(ctx);
+
+    uint16_t pending = LZW_NO_CODE;
+    uint16_t prev = LZW_NO_CODE;
+
+    for (size_t i = 0; i < input->length;) {
+        const uint8_t symbol = input->data[i];
+        const size_t start = i;
+        uint16_t seq = symbol;
+        size_t seq_length = 1;
+        size_t run = ctx->lzap ? 0 : byte_run_length(input->data + i, input->length - i);
+        if (run >= LZW_RUN_MIN_LENGTH) {
+            int code = lzw_compress_run(ctx, symbol, run, out, &pending, &seq_length);
+            if (code < 0) {
                 error = true;
                 goto cleanup;
             }
-            lzw_hash_table_insert(dict, candidate, next_code++);
-            string_clear(seq);
-            if (string_push(seq, symbol) < 0) {
-                error = true;
-                goto cleanup;
+            seq = code;
+            i += run;
+        } else {
+            i += 1;
+        }
+        for (; i < input->length; ++i) {
+            uint16_t candidate = lzw_context_get(ctx, seq, input->data[i]);
+            if (candidate == LZW_NO_CODE) {
+                break;
             }
+            seq = candidate;
+            seq_length += 1;
         }
-    }
-
-    if (seq->length > 0) {
-        LZW_Entry *seq_entry = lzw_hash_table_get(dict, seq);
-        if (!seq_entry) {
+        if (lzw_emit(ctx, out, &pending, seq) < 0) {
             error = true;
             goto cleanup;
         }
-        if (lzw_code_list_push(list, seq_entry->code) < 0) {
-            error = true;
-            goto cleanup;
+        if (ctx->stats) {
+            stats_match(ctx->stats, seq_length > 1 ? seq_length : 0, 0);
         }
+        if (ctx->lzap) {
+            prev = lzap_extend(ctx, prev, seq, input->data + start, seq_length);
+        } else if (i < input->length) {
+            lzw_context_insert(ctx, seq, input->data[i]);
+        }
+    }
+    if (pending != LZW_NO_CODE && lzw_emit(ctx, out, &pending, LZW_NO_CODE) < 0) {
+        error = true;
+        goto cleanup;
+    }
+    if (ctx->stats) {
+        size_t used = ctx->next_code - LZW_FIRST_CODE;
+        stats_dict(ctx->stats, ctx->next_code, ctx->max_codes, used, ctx->hash_size);
     }
 
 cleanup:
-    string_free(seq);
-    lzw_hash_table_free(dict);
-    if (error) {
-        lzw_code_list_free(list);
-        return NULL;
-    }
-    return list;
+    return error ? -1 : 0;
 }
 
-String *lzw_decompress(const void *compressed) {
-    const LZW_CodeList *list = compressed;
-    bool error = false;
-    String *result = NULL;
-    String *prev = NULL;
-    LZW_PrefixTable *dict = NULL;
-
-    result = string_new();
-    if (!result) {
-        error = true;
-        goto cleanup;
+// Writes the sequence of `code` into the room the caller reserved in `out`, which is checked
+// once; the walk through the prefixes then writes it backwards without checks.
+int lzw_entry_resolve(const LZW_Context *ctx, String *out, uint16_t code) {
+    size_t length = ctx->entries[code].length;
+    if (length > out->capacity - 1 - out->length) {
+        return -1;
+    }
+    out->length += length;
+    uint8_t *p = out->data + out->length;
+    for (size_t i = 0; i < length; ++i) {
+        *--p = ctx->entries[code].symbol;
+        code = ctx->entries[code].prefix;
     }
+    return 0;
+}
 
-    dict = lzw_prefix_table_new(UINT8_MAX + list->length);
-    if (!dict) {
-        error = true;
-        goto cleanup;
+// Decodes a single code into `out`, defining the entry that the previous code implied.
+int lzw_decode_code(LZW_Context *ctx, String *out, uint16_t *prev, uint16_t code) {
+    uint8_t first;
+    if (code < ctx->next_code) {
+        first = ctx->entries[code].first;
+    } else if (code == ctx->next_code && *prev != LZW_NO_CODE) {
+        // The code being defined right now: the previous sequence plus its own first symbol.
+        first = ctx->entries[*prev].first;
+    } else {
+        return -1;
     }
-    uint16_t next_code = 0;
-    for (int ch = 0; ch <= UINT8_MAX; ++ch) {
-        String *s = string_new();
-        if (!s) {
-            error = true;
-            goto cleanup;
-        }
-        if (string_push(s, ch) < 0) {
-            error = true;
-            goto cleanup;
-        }
-        if (lzw_prefix_table_insert(dict, next_code++, s) < 0) {
-            error = true;
-            goto cleanup;
+    if (*prev != LZW_NO_CODE) {
+        lzw_context_define(ctx, ctx->next_code, *prev, first);
+        if (++ctx->next_code == ctx->max_codes) {
+            lzw_context_full(ctx);
         }
     }
+    if (lzw_entry_resolve(ctx, out, code) < 0) {
+        return -1;
+    }
+    *prev = code;
+    return 0;
+}
 
-    for (size_t i = 0; i < list->length; ++i) {
-        uint16_t code = list->data[i];
-        String *seq = lzw_prefix_table_get(dict, code);
-        bool is_seq_allocated = false;
-        if (!seq && prev) {
-            seq = string_copy(prev);
-            if (!seq) {
-                error = true;
-                goto cleanup;
+// lzap_extend for the phrase `code` just written at `offset` of `block`, without its lookups.
+// The encoder's walk for `prev` stopped because `prev` plus the next symbol was missing, so
+// any extension of `prev` that exists now was defined by the extension right after it: a
+// prefix of the two phrases before this one, which are in the block as well. Comparing them
+// with `prev` and this phrase once tells how far the walk follows existing codes, and the new
+// ones are defined straight from the block.
+void lzap_decode_extend(LZW_Context *ctx, LZAP_Decoder *dec, const uint8_t *block, uint16_t code, uint32_t offset) {
+    uint16_t prev = dec->prev;
+    uint32_t prev_offset = dec->prev_offset;
+    size_t ext_count = dec->ext_count;
+    dec->prev = code;
+    dec->prev_offset = offset;
+    dec->ext_count = 0;
+    if (prev == LZW_NO_CODE) {
+        return;
+    }
+    size_t prev_length = ctx->entries[prev].length;
+    size_t length = ctx->entries[code].length;
+    uint16_t node = prev;
+    size_t known = 0;
+    if (ext_count > 0) {
+        // The extension's codes are one chain of sequences starting at its offset, the first
+        // `ext->length` long; only one reaching past `prev` can be `prev` plus a prefix.
+        const LZW_Entry *ext = &ctx->entries[dec->ext_code];
+        size_t longest = ext->length + ext_count - 1;
+        if (ext->length <= prev_length + 1 && longest > prev_length) {
+            size_t max = longest < prev_length + length ? longest : prev_length + length;
+            const uint8_t *a = block + ext->offset;
+            const uint8_t *b = block + prev_offset;
+            size_t same = 0;
+            while (same < max && a[same] == b[same]) {
+                same += 1;
             }
-            if (string_push(seq, prev->data[0]) < 0) {
-                error = true;
-                goto cleanup;
+            if (same > prev_length) {
+                known = same - prev_length;
+                node = dec->ext_code + (same - ext->length);
             }
-            is_seq_allocated = true;
         }
-        for (size_t j = 0; j < seq->length; ++j) {
-            if (string_push(result, seq->data[j]) < 0) {
-                error = true;
-                goto cleanup;
-            }
+    }
+    dec->ext_code = ctx->next_code;
+    for (size_t i = known; i < length; ++i) {
+        // Entries hold their length in 16 bits; longer ones are left out on both sides.
+        if (ctx->entries[node].length == UINT16_MAX) {
+            break;
         }
-        if (prev) {
-            String *candidate = string_copy(prev);
-            if (!candidate) {
-                error = true;
-                goto cleanup;
-            }
-            if (string_push(candidate, seq->data[0]) < 0) {
-                error = true;
-                goto cleanup;
-            }
-            if (lzw_prefix_table_insert(dict, next_code++, candidate) < 0) {
-                error = true;
-                goto cleanup;
-            }
-            string_free(prev);
+        uint16_t next = ctx->next_code;
+        lzw_context_define(ctx, next, node, block[offset + i]);
+        ctx->entries[next].offset = prev_offset;
+        node = next;
+        dec->ext_count += 1;
+        if (++ctx->next_code == ctx->max_codes) {
+            lzw_context_full(ctx);
+            dec->prev = LZW_NO_CODE;
+            return;
         }
-        if (is_seq_allocated) {
-            prev = seq;
-        } else {
-            prev = string_copy(seq);
+    }
+}
+
+// LZAP only ever refers to codes already defined. The ones defined in this block are copied
+// from where they were written; the first ones (bytes, a dictionary's) walk their prefixes.
+int lzap_decode_code(LZW_Context *ctx, String *out, size_t start, LZAP_Decoder *dec, uint16_t code) {
+    if (code >= ctx->next_code) {
+        return -1;
+    }
+    size_t offset = out->length - start;
+    if (code < ctx->first_code) {
+        if (lzw_entry_resolve(ctx, out, code) < 0) {
+            return -1;
+        }
+    } else {
+        const LZW_Entry *entry = &ctx->entries[code];
+        if (entry->length > out->capacity - 1 - out->length) {
+            return -1;
         }
+        memcpy(out->data + out->length, out->data + start + entry->offset, entry->length);
+        out->length += entry->length;
     }
+    lzap_decode_extend(ctx, dec, out->data + start, code, offset);
+    return 0;
+}
 
-cleanup:
-    lzw_prefix_table_free(dict);
-    string_free(prev);
-    if (error) {
-        string_free(result);
-        return NULL;
+// Offsets within the block fit 32 bits, as a block's size does.
+int lzap_decode(LZW_Context *ctx, const uint8_t *src, size_t length, String *out) {
+    if (length % 2 != 0) {
+        return -1;
+    }
+    LZAP_Decoder dec = {.prev = LZW_NO_CODE};
+    size_t start = out->length;
+    for (size_t i = 0; i < length; i += 2) {
+        if (lzap_decode_code(ctx, out, start, &dec, uint16_be_read(src + i)) < 0) {
+            return -1;
+        }
+    }
+    if (ctx->stats) {
+        ctx->stats->tokens += length / 2;
+    }
+    out->data[out->length] = '\0';
+    return 0;
+}
+
+// Decodes a serialized code stream straight into `out`, three bytes (two codes) at a time.
+int lzw_decode(void *ctx_, const uint8_t *src, size_t length, String *out) {
+    LZW_Context *ctx = ctx_;
+    lzw_context_reset(ctx);
+    if (ctx->lzap) {
+        return lzap_decode(ctx, src, length, out);
+    }
+    // Pairs of codes in 3 bytes, then possibly a lone code in 2.
+    size_t pairs_length = length - length % 3;
+    if (length % 3 == 1) {
+        return -1;
+    }
+
+    uint16_t prev = LZW_NO_CODE;
+    for (size_t i = 0; i < pairs_length; i += 3) {
+        uint16_t code1, code2;
+        bytes_to_codes(src + i, &code1, &code2);
+        if (lzw_decode_code(ctx, out, &prev, code1) < 0 || lzw_decode_code(ctx, out, &prev, code2) < 0) {
+            return -1;
+        }
     }
-    return result;
+    if (pairs_length < length && lzw_decode_code(ctx, out, &prev, uint16_be_read(src + pairs_length)) < 0) {
+        return -1;
+    }
+    if (ctx->stats) {
+        ctx->stats->tokens += pairs_length / 3 * 2 + (pairs_length < length);
+    }
+    out->data[out->length] = '\0';
+    return 0;
 }
 
 void lzw_print(const void *compressed, FILE *stream) {
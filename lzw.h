@@ -7,15 +7,32 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "stats.h"
 #include "string.h"
 
-int lzw_serialize(const void *compressed, FILE *stream);
+void *lzw_context_new(void);
+
+void *lzap_context_new(void);
+
+void lzw_context_reset(void *ctx);
+
+void lzw_context_set_stats(void *ctx, Stats *stats);
+
+void lzw_context_free(void *ctx);
+
+size_t lzw_context_size(void);
+
+size_t lzap_context_size(void);
+
+int lzw_context_set_dict(void *ctx, const String *dict);
 
 void *lzw_deserialize(FILE *stream);
 
-void *lzw_compress(const String *input);
+void *lzap_deserialize(FILE *stream);
+
+int lzw_compress(void *ctx, const String *input, String *out);
 
-String *lzw_decompress(const void *compressed);
+int lzw_decode(void *ctx, const uint8_t *src, size_t length, String *out);
 
 void lzw_print(const void *compressed, FILE *stream);
 
@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _DEFAULT_SOURCE
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "mem.h"
+
+// Every allocation of the program goes through here, so that a budget (--max-memory) can be
+// enforced in one place: an allocation that would take the total over the limit fails like an
+// out-of-memory malloc, and the caller's usual error path takes over. Each block is prefixed
+// with its size, padded to keep the returned pointer aligned for any type. The counters are
+// shared by all threads.
+#define MEM_HEADER_SIZE _Alignof(max_align_t)
+// Regions at least this large ask for transparent huge pages.
+#define MEM_HUGE_PAGE_SIZE (2 << 20)
+#define MEM_ARENA_MIN_CHUNK (64 << 10)
+
+atomic_size_t mem_limit_bytes;
+atomic_size_t mem_used_bytes;
+atomic_size_t mem_peak_bytes;
+atomic_bool mem_limit_hit_flag;
+
+// 0 means no limit.
+void mem_set_limit(size_t limit) {
+    atomic_store(&mem_limit_bytes, limit);
+}
+
+size_t mem_limit(void) {
+    return atomic_load(&mem_limit_bytes);
+}
+
+size_t mem_used(void) {
+    return atomic_load(&mem_used_bytes);
+}
+
+size_t mem_peak(void) {
+    return atomic_load(&mem_peak_bytes);
+}
+
+// Whether an allocation has failed because of the limit (rather than the system).
+bool mem_limit_hit(void) {
+    return atomic_load(&mem_limit_hit_flag);
+}
+
+bool mem_reserve(size_t size) {
+    size_t used = atomic_fetch_add(&mem_used_bytes, size) + size;
+    size_t limit = atomic_load(&mem_limit_bytes);
+    if (limit > 0 && used > limit) {
+        atomic_fetch_sub(&mem_used_bytes, size);
+        atomic_store(&mem_limit_hit_flag, true);
+        return false;
+    }
+    size_t peak = atomic_load(&mem_peak_bytes);
+    while (used > peak && !atomic_compare_exchange_weak(&mem_peak_bytes, &peak, used)) {
+    }
+    return true;
+}
+
+void mem_release(size_t size) {
+    atomic_fetch_sub(&mem_used_bytes, size);
+}
+
+void *mem_alloc(size_t size) {
+    if (size > SIZE_MAX - MEM_HEADER_SIZE || !mem_reserve(size)) {
+        return NULL;
+    }
+    char *block = malloc(MEM_HEADER_SIZE + size);
+    if (!block) {
+        mem_release(size);
+        return NULL;
+    }
+    memcpy(block, &size, sizeof(size));
+    return block + MEM_HEADER_SIZE;
+}
+
+void *mem_calloc(size_t count, size_t size) {
+    if (size > 0 && count > SIZE_MAX / size) {
+        return NULL;
+    }
+    void *ptr = mem_alloc(count * size);
+    if (ptr) {
+        memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+// Like realloc, the original block is left untouched on failure.
+void *mem_realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return mem_alloc(size);
+    }
+    char *block = (char *)ptr - MEM_HEADER_SIZE;
+    size_t old_size;
+    memcpy(&old_size, block, sizeof(old_size));
+    if (size > SIZE_MAX - MEM_HEADER_SIZE) {
+        return NULL;
+    }
+    if (size > old_size && !mem_reserve(size - old_size)) {
+        return NULL;
+    }
+    char *grown = realloc(block, MEM_HEADER_SIZE + size);
+    if (!grown) {
+        if (size > old_size) {
+            mem_release(size - old_size);
+        }
+        return NULL;
+    }
+    if (size < old_size) {
+        mem_release(old_size - size);
+    }
+    memcpy(grown, &size, sizeof(size));
+    return grown + MEM_HEADER_SIZE;
+}
+
+void mem_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    char *block = (char *)ptr - MEM_HEADER_SIZE;
+    size_t size;
+    memcpy(&size, block, sizeof(size));
+    mem_release(size);
+    free(block);
+}
+
+size_t mem_page_round(size_t size) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+// Zero-filled pages straight from the kernel, for large tables that live as long as a
+// context. They are only backed once touched, and huge pages cut the TLB misses of random
+// accesses into multi-megabyte regions. Release with mem_unmap() and the same size.
+void *mem_map(size_t size) {
+    if (size == 0 || size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    size = mem_page_round(size);
+    if (!mem_reserve(size)) {
+        return NULL;
+    }
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        mem_release(size);
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= MEM_HUGE_PAGE_SIZE) {
+        // Only advice: without transparent huge pages the region works all the same.
+        madvise(ptr, size, MADV_HUGEPAGE);
+    }
+#endif
+    return ptr;
+}
+
+void mem_unmap(void *ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    size = mem_page_round(size);
+    munmap(ptr, size);
+    mem_release(size);
+}
+
+// A bump allocator for scratch memory that is dropped all at once. Allocations come from the
+// newest chunk; when it is full another one at least twice as large is added. A reset keeps
+// a single chunk as large as all of them together, so that a steady workload settles into
+// one mapping and no system calls.
+typedef struct MemArenaChunk {
+    struct MemArenaChunk *next;
+    size_t size;
+    size_t used;
+} MemArenaChunk;
+
+typedef struct {
+    MemArenaChunk *chunks;
+    size_t total;
+} MemArena;
+
+#define MEM_ARENA_CHUNK_HEADER ((sizeof(MemArenaChunk) + MEM_HEADER_SIZE - 1) / MEM_HEADER_SIZE * MEM_HEADER_SIZE)
+
+void *mem_arena_new(void) {
+    MemArena *arena = mem_alloc(sizeof(MemArena));
+    if (!arena) {
+        return NULL;
+    }
+    arena->chunks = NULL;
+    arena->total = 0;
+    return arena;
+}
+
+MemArenaChunk *mem_arena_chunk_new(MemArena *arena, size_t size) {
+    MemArenaChunk *chunk = mem_map(size);
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = arena->chunks;
+    chunk->size = mem_page_round(size);
+    chunk->used = MEM_ARENA_CHUNK_HEADER;
+    arena->chunks = chunk;
+    arena->total += chunk->size;
+    return chunk;
+}
+
+// Aligned for any type; valid until the next mem_arena_reset().
+void *mem_arena_alloc(void *arena_, size_t size) {
+    MemArena *arena = arena_;
+    size_t aligned = (size + MEM_HEADER_SIZE - 1) / MEM_HEADER_SIZE * MEM_HEADER_SIZE;
+    if (aligned < size || aligned > SIZE_MAX / 4) {
+        return NULL;
+    }
+    MemArenaChunk *chunk = arena->chunks;
+    if (!chunk || chunk->size - chunk->used < aligned) {
+        size_t chunk_size = MEM_ARENA_CHUNK_HEADER + aligned;
+        size_t grown = chunk ? chunk->size * 2 : MEM_ARENA_MIN_CHUNK;
+        chunk = mem_arena_chunk_new(arena, chunk_size > grown ? chunk_size : grown);
+        if (!chunk) {
+            return NULL;
+        }
+    }
+    void *ptr = (char *)chunk + chunk->used;
+    chunk->used += aligned;
+    return ptr;
+}
+
+void mem_arena_chunks_free(MemArena *arena) {
+    while (arena->chunks) {
+        MemArenaChunk *next = arena->chunks->next;
+        mem_unmap(arena->chunks, arena->chunks->size);
+        arena->chunks = next;
+    }
+    arena->total = 0;
+}
+
+void mem_arena_reset(void *arena_) {
+    MemArena *arena = arena_;
+    if (arena->chunks && arena->chunks->next) {
+        size_t total = arena->total;
+        mem_arena_chunks_free(arena);
+        // On failure the arena is merely empty; the next allocation retries.
+        mem_arena_chunk_new(arena, total);
+    }
+    if (arena->chunks) {
+        arena->chunks->used = MEM_ARENA_CHUNK_HEADER;
+    }
+}
+
+// An upper bound on what an arena holds when it is reset before every allocation of up to
+// `size` bytes: each new chunk at least doubles the last, and a reset joins them into one.
+size_t mem_arena_size_for(size_t size) {
+    size_t chunk = mem_page_round(MEM_ARENA_CHUNK_HEADER + size);
+    return chunk <= MEM_ARENA_MIN_CHUNK ? MEM_ARENA_MIN_CHUNK : 3 * chunk;
+}
+
+void mem_arena_free(void *arena_) {
+    MemArena *arena = arena_;
+    if (!arena) {
+        return;
+    }
+    mem_arena_chunks_free(arena);
+    mem_free(arena);
+}
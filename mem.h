@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void mem_set_limit(size_t limit);
+
+size_t mem_limit(void);
+
+size_t mem_used(void);
+
+size_t mem_peak(void);
+
+bool mem_limit_hit(void);
+
+void *mem_alloc(size_t size);
+
+void *mem_calloc(size_t count, size_t size);
+
+void *mem_realloc(void *ptr, size_t size);
+
+void mem_free(void *ptr);
+
+void *mem_map(size_t size);
+
+void mem_unmap(void *ptr, size_t size);
+
+void *mem_arena_new(void);
+
+void *mem_arena_alloc(void *arena, size_t size);
+
+void mem_arena_reset(void *arena);
+
+size_t mem_arena_size_for(size_t size);
+
+void mem_arena_free(void *arena);
+
+#endif // MEM_H
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+const char *stats_phase_names[STATS_PHASE_COUNT] = {
+    [STATS_READ] = "read",
+    [STATS_COMPRESS] = "compress",
+    [STATS_DECOMPRESS] = "decompress",
+    [STATS_WRITE] = "write",
+};
+
+double stats_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Monotonic seconds, for timing outside the phases.
+double stats_wall_clock(void) {
+    return stats_clock(CLOCK_MONOTONIC);
+}
+
+void stats_begin(Stats *stats, StatsPhase phase) {
+    if (!stats) {
+        return;
+    }
+    StatsTimer *timer = &stats->phases[phase];
+    timer->wall_start = stats_clock(CLOCK_MONOTONIC);
+    timer->cpu_start = stats_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void stats_end(Stats *stats, StatsPhase phase) {
+    if (!stats) {
+        return;
+    }
+    StatsTimer *timer = &stats->phases[phase];
+    timer->wall += stats_clock(CLOCK_MONOTONIC) - timer->wall_start;
+    timer->cpu += stats_clock(CLOCK_THREAD_CPUTIME_ID) - timer->cpu_start;
+    timer->calls += 1;
+}
+
+size_t stats_bucket(size_t value) {
+    size_t bucket = 0;
+    while (value > 1 && bucket + 1 < STATS_HISTOGRAM_BUCKETS) {
+        value >>= 1;
+        bucket += 1;
+    }
+    return bucket;
+}
+
+// Records one token. Tokens without a match are literals; dictionary codecs have no
+// offset and pass 0.
+void stats_match(Stats *stats, size_t length, size_t offset) {
+    stats->tokens += 1;
+    if (length == 0) {
+        stats->literals += 1;
+        return;
+    }
+    stats->matches += 1;
+    stats->length_histogram[stats_bucket(length)] += 1;
+    if (offset > 0) {
+        stats->offset_histogram[stats_bucket(offset)] += 1;
+    }
+}
+
+void stats_dict(Stats *stats, size_t entries, size_t capacity, size_t table_used, size_t table_size) {
+    if (entries > stats->dict_entries) {
+        stats->dict_entries = entries;
+    }
+    stats->dict_capacity = capacity;
+    if (table_used > stats->table_used) {
+        stats->table_used = table_used;
+    }
+    stats->table_size = table_size;
+}
+
+// Adds the counts of `from` (for example one worker thread's) to `into`.
+void stats_merge(Stats *into, const Stats *from) {
+    for (size_t i = 0; i < STATS_PHASE_COUNT; ++i) {
+        into->phases[i].calls += from->phases[i].calls;
+        into->phases[i].wall += from->phases[i].wall;
+        into->phases[i].cpu += from->phases[i].cpu;
+    }
+    into->input_bytes += from->input_bytes;
+    into->output_bytes += from->output_bytes;
+    into->tokens += from->tokens;
+    into->stored_blocks += from->stored_blocks;
+    into->long_matches += from->long_matches;
+    into->long_match_bytes += from->long_match_bytes;
+    into->literals += from->literals;
+    into->matches += from->matches;
+    into->rep_matches += from->rep_matches;
+    into->chain_searches += from->chain_searches;
+    into->chain_steps += from->chain_steps;
+    into->dict_resets += from->dict_resets;
+    for (size_t i = 0; i < STATS_HISTOGRAM_BUCKETS; ++i) {
+        into->length_histogram[i] += from->length_histogram[i];
+        into->offset_histogram[i] += from->offset_histogram[i];
+    }
+    for (size_t i = 0; i < STATS_LEVELS; ++i) {
+        into->level_blocks[i] += from->level_blocks[i];
+    }
+    if (from->target_speed > 0) {
+        into->target_speed = from->target_speed;
+        into->last_level = from->last_level;
+    }
+    if (from->peak_memory > into->peak_memory) {
+        into->peak_memory = from->peak_memory;
+    }
+    if (from->dict_capacity > 0) {
+        stats_dict(into, from->dict_entries, from->dict_capacity, from->table_used, from->table_size);
+    }
+}
+
+void stats_print_histogram(const uint64_t *histogram, FILE *stream) {
+    size_t length = STATS_HISTOGRAM_BUCKETS;
+    while (length > 0 && histogram[length - 1] == 0) {
+        length -= 1;
+    }
+    fputc('[', stream);
+    for (size_t i = 0; i < length; ++i) {
+        fprintf(stream, "%s%llu", i ? ", " : "", (unsigned long long)histogram[i]);
+    }
+    fputc(']', stream);
+}
+
+// Prints everything as a single JSON object so runs can be collected and compared by scripts.
+void stats_print(const Stats *stats, const char *algo, FILE *stream) {
+    fprintf(stream, "{\"algo\": \"%s\", \"phases\": {", algo);
+    const char *separator = "";
+    for (size_t i = 0; i < STATS_PHASE_COUNT; ++i) {
+        const StatsTimer *timer = &stats->phases[i];
+        if (timer->calls == 0) {
+            continue;
+        }
+        fprintf(stream, "%s\"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}", separator, stats_phase_names[i],
+            timer->wall, timer->cpu);
+        separator = ", ";
+    }
+    fprintf(stream, "}, \"input_bytes\": %llu, \"output_bytes\": %llu",
+        (unsigned long long)stats->input_bytes, (unsigned long long)stats->output_bytes);
+    fprintf(stream, ", \"tokens\": %llu", (unsigned long long)stats->tokens);
+    if (stats->stored_blocks > 0) {
+        fprintf(stream, ", \"stored_blocks\": %llu", (unsigned long long)stats->stored_blocks);
+    }
+    if (stats->long_matches > 0) {
+        fprintf(stream, ", \"long_matches\": {\"count\": %llu, \"bytes\": %llu}",
+            (unsigned long long)stats->long_matches, (unsigned long long)stats->long_match_bytes);
+    }
+    // Match details are only collected while compressing.
+    if (stats->literals + stats->matches > 0) {
+        fprintf(stream, ", \"literals\": %llu, \"matches\": %llu",
+            (unsigned long long)stats->literals, (unsigned long long)stats->matches);
+        if (stats->rep_matches > 0) {
+            fprintf(stream, ", \"rep_matches\": %llu", (unsigned long long)stats->rep_matches);
+        }
+        fprintf(stream, ", \"match_length_histogram\": ");
+        stats_print_histogram(stats->length_histogram, stream);
+        fprintf(stream, ", \"match_offset_histogram\": ");
+        stats_print_histogram(stats->offset_histogram, stream);
+    }
+    if (stats->chain_searches > 0) {
+        fprintf(stream, ", \"chain_depth_avg\": %.3f", (double)stats->chain_steps / stats->chain_searches);
+    }
+    if (stats->dict_capacity > 0) {
+        fprintf(stream, ", \"dict\": {\"entries\": %llu, \"capacity\": %llu, \"resets\": %llu, \"load\": %.3f}",
+            (unsigned long long)stats->dict_entries, (unsigned long long)stats->dict_capacity,
+            (unsigned long long)stats->dict_resets, (double)stats->table_used / stats->table_size);
+    }
+    if (stats->target_speed > 0) {
+        fprintf(stream, ", \"target_speed\": {\"mb_per_s\": %.1f, \"last_level\": %d, \"level_blocks\": {",
+            stats->target_speed / 1e6, stats->last_level);
+        separator = "";
+        for (size_t i = 0; i < STATS_LEVELS; ++i) {
+            if (stats->level_blocks[i] > 0) {
+                fprintf(stream, "%s\"%zu\": %llu", separator, i, (unsigned long long)stats->level_blocks[i]);
+                separator = ", ";
+            }
+        }
+        fprintf(stream, "}}");
+    }
+    if (stats->peak_memory > 0) {
+        fprintf(stream, ", \"peak_memory_bytes\": %llu", (unsigned long long)stats->peak_memory);
+    }
+    fprintf(stream, "}\n");
+}
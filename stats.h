@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum {
+    STATS_READ,
+    STATS_COMPRESS,
+    STATS_DECOMPRESS,
+    STATS_WRITE,
+    STATS_PHASE_COUNT,
+} StatsPhase;
+
+// Histogram bucket `i` counts values in [2^i, 2^(i+1)).
+#define STATS_HISTOGRAM_BUCKETS 32
+// LZ77 levels are 1 to 9; index 0 stays unused.
+#define STATS_LEVELS 10
+
+typedef struct {
+    uint64_t calls;
+    double wall;
+    double cpu;
+    double wall_start;
+    double cpu_start;
+} StatsTimer;
+
+typedef struct {
+    StatsTimer phases[STATS_PHASE_COUNT];
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+    uint64_t tokens;
+    uint64_t stored_blocks;
+    uint64_t long_matches;
+    uint64_t long_match_bytes;
+    uint64_t literals;
+    uint64_t matches;
+    uint64_t rep_matches;
+    uint64_t length_histogram[STATS_HISTOGRAM_BUCKETS];
+    uint64_t offset_histogram[STATS_HISTOGRAM_BUCKETS];
+    uint64_t chain_searches;
+    uint64_t chain_steps;
+    uint64_t dict_entries;
+    uint64_t dict_capacity;
+    uint64_t dict_resets;
+    uint64_t table_used;
+    uint64_t table_size;
+    // Largest heap use seen by the mem_* allocator.
+    uint64_t peak_memory;
+    // With --target-speed: the target in bytes per second, the blocks compressed at each
+    // level and the level in use at the end.
+    double target_speed;
+    uint64_t level_blocks[STATS_LEVELS];
+    int last_level;
+} Stats;
+
+double stats_wall_clock(void);
+
+void stats_begin(Stats *stats, StatsPhase phase);
+
+void stats_end(Stats *stats, StatsPhase phase);
+
+void stats_match(Stats *stats, size_t length, size_t offset);
+
+void stats_dict(Stats *stats, size_t entries, size_t capacity, size_t table_used, size_t table_size);
+
+void stats_merge(Stats *into, const Stats *from);
+
+void stats_print(const Stats *stats, const char *algo, FILE *stream);
+
+#endif // STATS_H
@@ -1,39 +1,63 @@
 /* SPDX-License-Identifier: MIT */
 /* Copyright (c) 2025 Saleh Zaidan */
-/* Version: 1.0.0 */
+/* Version: 1.3.0 */
 
 #include <stdlib.h>
 #include <string.h>
 
+#include "mem.h"
 #include "string.h"
 
 String *string_new() {
-#define STRING_DEFAULT_CAPACITY 8
-    String *s = malloc(sizeof(String));
+    return string_with_capacity(1);
+}
+
+// An empty string with room for exactly `capacity` bytes (the terminator included), so a
+// buffer whose size is known up front is allocated once.
+String *string_with_capacity(size_t capacity) {
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    String *s = mem_alloc(sizeof(String));
     if (!s) {
         return NULL;
     }
-    s->capacity = STRING_DEFAULT_CAPACITY;
+    s->capacity = capacity;
     s->length = 0;
-    char *data = malloc(sizeof(char) * STRING_DEFAULT_CAPACITY);
-    if (!data) {
-        string_free(s);
+    s->data = mem_alloc(capacity);
+    if (!s->data) {
+        mem_free(s);
         return NULL;
     }
-    data[s->length] = '\0';
-    s->data = data;
+    s->data[0] = '\0';
     return s;
-#undef STRING_DEFAULT_CAPACITY
 }
 
-String *string_copy(const String *s) {
-    String *s_copy = string_new();
-    if (!s_copy) {
+// A borrowed view of `length` bytes, for passing memory owned elsewhere to code that only
+// reads a String. It has no room for a terminator and must not be grown or freed.
+String string_view(const void *data, size_t length) {
+    return (String){.capacity = length, .length = length, .data = (uint8_t *)data};
+}
+
+// An empty string with room for `capacity` characters (the null terminator included), taken
+// from a mem arena. It must not grow beyond that nor be freed: it goes with the arena's reset.
+String *string_arena_new(void *arena, size_t capacity) {
+    String *s = mem_arena_alloc(arena, sizeof(String));
+    uint8_t *data = capacity > 0 ? mem_arena_alloc(arena, capacity) : NULL;
+    if (!s || !data) {
         return NULL;
     }
+    s->capacity = capacity;
+    s->length = 0;
+    s->data = data;
+    s->data[0] = '\0';
+    return s;
+}
+
+String *string_copy(const String *s) {
     // +1 to reserve space for the null terminator.
-    if (string_reserve(s_copy, s->length + 1) < 0) {
-        string_free(s_copy);
+    String *s_copy = string_with_capacity(s->length + 1);
+    if (!s_copy) {
         return NULL;
     }
     memcpy(s_copy->data, s->data, s->length);
@@ -43,29 +67,34 @@ String *string_copy(const String *s) {
 }
 
 String *string_from_stream(FILE *stream) {
+#define STRING_READ_SIZE 65536
     String *s = string_new();
     if (!s) {
         return NULL;
     }
-    int ch;
-    while ((ch = fgetc(stream)) != EOF) {
-        if (string_push(s, ch) < 0) {
+    size_t read;
+    do {
+        if (string_grow(s, STRING_READ_SIZE) < 0) {
             string_free(s);
             return NULL;
         }
+        read = fread(s->data + s->length, 1, s->capacity - s->length - 1, stream);
+        s->length += read;
+    } while (read > 0);
+    s->data[s->length] = '\0';
+    if (ferror(stream)) {
+        string_free(s);
+        return NULL;
     }
     return s;
+#undef STRING_READ_SIZE
 }
 
 String *string_from_cstr(const char *cstr) {
     size_t cstr_len = strlen(cstr);
-    String *s = string_new();
-    if (!s) {
-        return NULL;
-    }
     // +1 to reserve space for the null terminator.
-    if (string_reserve(s, cstr_len + 1) < 0) {
-        string_free(s);
+    String *s = string_with_capacity(cstr_len + 1);
+    if (!s) {
         return NULL;
     }
     memcpy(s->data, cstr, cstr_len);
@@ -74,11 +103,12 @@ String *string_from_cstr(const char *cstr) {
     return s;
 }
 
+// Grows the buffer to exactly `capacity` bytes, if it is smaller.
 int string_reserve(String *s, size_t capacity) {
     if (s->capacity >= capacity) {
         return 0;
     }
-    char *data_new = realloc(s->data, sizeof(char) * capacity);
+    uint8_t *data_new = mem_realloc(s->data, capacity);
     if (!data_new) {
         return -1;
     }
@@ -87,9 +117,19 @@ int string_reserve(String *s, size_t capacity) {
     return 0;
 }
 
+// Makes room for `additional` more characters (plus the null terminator), doubling the
+// capacity so that repeated appends stay amortized O(1).
+int string_grow(String *s, size_t additional) {
+    size_t capacity = s->capacity;
+    while (capacity < s->length + additional + 1) {
+        capacity *= 2;
+    }
+    return string_reserve(s, capacity);
+}
+
 void string_free(String *s) {
-    free(s->data);
-    free(s);
+    mem_free(s->data);
+    mem_free(s);
 }
 
 void string_clear(String *s) {
@@ -97,15 +137,23 @@ void string_clear(String *s) {
     s->data[s->length] = '\0';
 }
 
-int string_push(String *s, char ch) {
+// Appends `length` bytes with a single copy. Like string_push(), it writes no terminator.
+int string_append(String *s, const void *data, size_t length) {
+    if (string_grow(s, length) < 0) {
+        return -1;
+    }
+    memcpy(s->data + s->length, data, length);
+    s->length += length;
+    return 0;
+}
+
+int string_push(String *s, uint8_t byte) {
     // +1 to reserve space for the null terminator.
     if (s->length + 1 >= s->capacity) {
         if (string_reserve(s, s->capacity * 2) < 0) {
             return -1;
         }
     }
-    s->data[s->length++] = ch;
-    s->data[s->length] = '\0';
+    s->data[s->length++] = byte;
     return 0;
 }
-
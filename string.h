@@ -1,21 +1,30 @@
 /* SPDX-License-Identifier: MIT */
 /* Copyright (c) 2025 Saleh Zaidan */
-/* Version: 1.0.0 */
+/* Version: 1.3.0 */
 
 #ifndef STRING_H
 #define STRING_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 
+// A buffer of bytes, any of which may be 0: `length` is what counts. An owned string always
+// has room for a terminator after them, but only the functions that say so write one.
 typedef struct {
     size_t capacity;
     size_t length;
-    char *data;
+    uint8_t *data;
 } String;
 
 String *string_new();
 
+String *string_with_capacity(size_t capacity);
+
+String string_view(const void *data, size_t length);
+
+String *string_arena_new(void *arena, size_t capacity);
+
 String *string_copy(const String *s);
 
 String *string_from_stream(FILE *stream);
@@ -24,11 +33,15 @@ String *string_from_cstr(const char *cstr);
 
 int string_reserve(String *s, size_t capacity);
 
+int string_grow(String *s, size_t additional);
+
 void string_clear(String *s);
 
 void string_free(String *s);
 
-int string_push(String *s, char ch);
+int string_append(String *s, const void *data, size_t length);
+
+int string_push(String *s, uint8_t byte);
 
 #endif // STRING_H
 
@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict.h"
+#include "frame.h"
+#include "lz.h"
+#include "mem.h"
+#include "string.h"
+#include "verify.h"
+
+// Every encoded block is copied into a slot of a small ring, together with its input, and
+// decoded on the verifier's thread while the next block is compressed. Decoding is much
+// faster than compressing, so the thread keeps up and the only cost on the compressing side
+// is the two copies. Slots keep their buffers, so a steady stream allocates nothing.
+
+#define VERIFY_DEPTH 2
+
+typedef struct {
+    BlockHeader block;
+    uint64_t offset;
+    String *source;
+    String *payload;
+} VerifyJob;
+
+typedef struct {
+    LZ_Context *ctx;
+    FrameHeader header;
+    VerifyJob jobs[VERIFY_DEPTH];
+    // jobs[head] is being (or about to be) verified; `count` slots from it are taken.
+    size_t head;
+    size_t count;
+    bool failed;
+    uint64_t failed_offset;
+    bool stop;
+    bool started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Verifier;
+
+bool verify_job(Verifier *verifier, const VerifyJob *job) {
+    const uint8_t *payload = job->payload->data;
+    String *decoded = frame_block_decode_payload(verifier->ctx, &verifier->header, &job->block, payload);
+    bool ok = decoded && decoded->length == job->source->length &&
+        memcmp(decoded->data, job->source->data, decoded->length) == 0;
+    if (decoded) {
+        string_free(decoded);
+    }
+    return ok;
+}
+
+void *verify_main(void *verifier_) {
+    Verifier *verifier = verifier_;
+    pthread_mutex_lock(&verifier->lock);
+    while (true) {
+        while (verifier->count == 0 && !verifier->stop) {
+            pthread_cond_wait(&verifier->cond, &verifier->lock);
+        }
+        if (verifier->count == 0) {
+            break;
+        }
+        VerifyJob *job = &verifier->jobs[verifier->head];
+        // After a mismatch the rest is only drained.
+        bool skip = verifier->failed;
+        pthread_mutex_unlock(&verifier->lock);
+        bool ok = skip || verify_job(verifier, job);
+        pthread_mutex_lock(&verifier->lock);
+        if (!ok && !verifier->failed) {
+            verifier->failed = true;
+            verifier->failed_offset = job->offset;
+        }
+        verifier->head = (verifier->head + 1) % VERIFY_DEPTH;
+        verifier->count -= 1;
+        pthread_cond_broadcast(&verifier->cond);
+    }
+    pthread_mutex_unlock(&verifier->lock);
+    return NULL;
+}
+
+// Verifies blocks compressed with `algo` and `dict` (NULL for none), decoding them with a
+// context of its own.
+void *verify_new(Algo algo, const Dict *dict) {
+    Verifier *verifier = mem_alloc(sizeof(Verifier));
+    if (!verifier) {
+        return NULL;
+    }
+    memset(verifier, 0, sizeof(Verifier));
+    verifier->ctx = lz_context_new(algo, LZ77_LEVEL_MIN);
+    if (!verifier->ctx || (dict && lz_context_set_dict(verifier->ctx, dict) < 0)) {
+        verify_free(verifier);
+        return NULL;
+    }
+    for (size_t i = 0; i < VERIFY_DEPTH; ++i) {
+        verifier->jobs[i].source = string_new();
+        verifier->jobs[i].payload = string_new();
+        if (!verifier->jobs[i].source || !verifier->jobs[i].payload) {
+            verify_free(verifier);
+            return NULL;
+        }
+    }
+    if (pthread_mutex_init(&verifier->lock, NULL) != 0) {
+        verify_free(verifier);
+        return NULL;
+    }
+    if (pthread_cond_init(&verifier->cond, NULL) != 0) {
+        pthread_mutex_destroy(&verifier->lock);
+        verify_free(verifier);
+        return NULL;
+    }
+    if (pthread_create(&verifier->thread, NULL, verify_main, verifier) != 0) {
+        pthread_cond_destroy(&verifier->cond);
+        pthread_mutex_destroy(&verifier->lock);
+        verify_free(verifier);
+        return NULL;
+    }
+    verifier->started = true;
+    return verifier;
+}
+
+// Starts a frame: blocks are decoded against `header`, and earlier failures are forgotten.
+void verify_begin(void *verifier_, const FrameHeader *header) {
+    Verifier *verifier = verifier_;
+    pthread_mutex_lock(&verifier->lock);
+    verifier->header = *header;
+    verifier->failed = false;
+    pthread_mutex_unlock(&verifier->lock);
+}
+
+int verify_string_set(String *s, const void *data, size_t length) {
+    if (string_reserve(s, length + 1) < 0) {
+        return -1;
+    }
+    memcpy(s->data, data, length);
+    s->length = length;
+    s->data[length] = '\0';
+    return 0;
+}
+
+// Queues the block encoded from `source` (at uncompressed offset `offset`) as `payload`,
+// waiting while the ring is full. Returns -1 once a block has failed, so the caller can stop.
+int verify_submit(void *verifier_, const BlockHeader *block, uint64_t offset, const uint8_t *source, const uint8_t *payload) {
+    Verifier *verifier = verifier_;
+    pthread_mutex_lock(&verifier->lock);
+    while (verifier->count == VERIFY_DEPTH && !verifier->failed) {
+        pthread_cond_wait(&verifier->cond, &verifier->lock);
+    }
+    bool failed = verifier->failed;
+    VerifyJob *job = &verifier->jobs[(verifier->head + verifier->count) % VERIFY_DEPTH];
+    pthread_mutex_unlock(&verifier->lock);
+    if (failed) {
+        return -1;
+    }
+
+    // The slot is free: the thread only touches slots counted in `count`.
+    job->block = *block;
+    job->offset = offset;
+    if (verify_string_set(job->source, source, block->uncompressed_size) < 0 ||
+        verify_string_set(job->payload, payload, block->compressed_size) < 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&verifier->lock);
+    verifier->count += 1;
+    pthread_cond_broadcast(&verifier->cond);
+    pthread_mutex_unlock(&verifier->lock);
+    return 0;
+}
+
+// Waits until every queued block is verified. Returns -1 if any of them did not decode to
+// its input.
+int verify_finish(void *verifier_) {
+    Verifier *verifier = verifier_;
+    pthread_mutex_lock(&verifier->lock);
+    while (verifier->count > 0) {
+        pthread_cond_wait(&verifier->cond, &verifier->lock);
+    }
+    bool failed = verifier->failed;
+    pthread_mutex_unlock(&verifier->lock);
+    return failed ? -1 : 0;
+}
+
+// Whether a block of the current frame failed, and if so the uncompressed offset of the first.
+bool verify_failed(void *verifier_, uint64_t *offset) {
+    Verifier *verifier = verifier_;
+    pthread_mutex_lock(&verifier->lock);
+    bool failed = verifier->failed;
+    *offset = verifier->failed_offset;
+    pthread_mutex_unlock(&verifier->lock);
+    return failed;
+}
+
+void verify_free(void *verifier_) {
+    Verifier *verifier = verifier_;
+    if (!verifier) {
+        return;
+    }
+    if (verifier->started) {
+        pthread_mutex_lock(&verifier->lock);
+        verifier->stop = true;
+        pthread_cond_broadcast(&verifier->cond);
+        pthread_mutex_unlock(&verifier->lock);
+        pthread_join(verifier->thread, NULL);
+        pthread_cond_destroy(&verifier->cond);
+        pthread_mutex_destroy(&verifier->lock);
+    }
+    if (verifier->ctx) {
+        lz_context_free(verifier->ctx);
+    }
+    for (size_t i = 0; i < VERIFY_DEPTH; ++i) {
+        if (verifier->jobs[i].source) {
+            string_free(verifier->jobs[i].source);
+        }
+        if (verifier->jobs[i].payload) {
+            string_free(verifier->jobs[i].payload);
+        }
+    }
+    mem_free(verifier);
+}
+
+// Memory held besides the decoding context: the ring, and what decoding a block takes.
+size_t verify_memory_needed(const FrameHeader *header) {
+    return (2 * VERIFY_DEPTH + 2) * ((size_t)header->block_size + 1);
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: MIT */
+/* Copyright (c) 2025 Saleh Zaidan */
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict.h"
+#include "frame.h"
+#include "lz.h"
+
+void *verify_new(Algo algo, const Dict *dict);
+
+void verify_begin(void *verifier, const FrameHeader *header);
+
+int verify_submit(void *verifier, const BlockHeader *block, uint64_t offset, const uint8_t *source, const uint8_t *payload);
+
+int verify_finish(void *verifier);
+
+bool verify_failed(void *verifier, uint64_t *offset);
+
+void verify_free(void *verifier);
+
+size_t verify_memory_needed(const FrameHeader *header);
+
+#endif // VERIFY_H